@@ -9,8 +9,9 @@
 #ifndef ArchitectureSpecific_h
 #define ArchitectureSpecific_h
 
-#ifdef SIMPLE_MIDI_TTY
-#define SIMPLE_MIDI_MULTITHREAD
+#ifdef SIMPLE_MIDI_TTY //Linux tty implementation, can be forced on any Linux based target by defining SIMPLE_MIDI_TTY
+#define SIMPLE_MIDI_MULTITHREADED
+#include "Linux/TTYMIDIWrapperDef.h"
 
 #elif defined ARDUINO //Arduino specific implementation
 #define SIMPLE_MIDI_ARDUINO
@@ -24,6 +25,11 @@
 #elif defined _WIN32 //Windows specific implementation
 #define SIMPLE_MIDI_WINDOWS
 #define SIMPLE_MIDI_MULTITHREADED
+
+#elif defined __linux__ //Linux has no MIDI API of its own that SimpleMIDI supports, so serial devices are used
+#define SIMPLE_MIDI_TTY
+#define SIMPLE_MIDI_MULTITHREADED
+#include "Linux/TTYMIDIWrapperDef.h"
 #endif
 
 #endif /* ArchitectureSpecific_h */
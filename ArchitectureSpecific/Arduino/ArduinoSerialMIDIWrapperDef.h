@@ -3,6 +3,9 @@
 
 #include "Arduino.h"
 
+// Small microcontrollers send the messages passed without checking the range of the arguments
+#define SIMPLE_MIDI_NO_RANGE_CHECKS
+
 #ifdef ENERGIA_ARCH_MSP430
 #define SIMPLE_MIDI_ARDUINO_NO_SOFT_SERIAL
 #define SIMPLE_MIDI_PRE_C++11
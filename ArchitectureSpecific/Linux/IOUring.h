@@ -0,0 +1,254 @@
+//
+//  IOUring.h
+//
+//  Minimal io_uring instance on top of the raw system calls, used by MIDIEventLoop
+//
+
+#ifndef IOUring_h
+#define IOUring_h
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Older kernel headers don't know multishot reads yet, the opcode is fixed since Linux 6.7
+#ifndef SIMPLE_MIDI_IORING_OP_READ_MULTISHOT
+#define SIMPLE_MIDI_IORING_OP_READ_MULTISHOT 49
+#endif
+
+
+/**
+ * Sets up a submission and completion queue and an optional ring of provided receive buffers, without depending
+ * on liburing. Only the features the event loop needs are wrapped. All functions must be called from the same
+ * thread, the kernel is only entered by submitAndWait().
+ */
+class IOUring {
+
+public:
+
+    IOUring (unsigned numEntries) {
+        io_uring_params params;
+        memset (&params, 0, sizeof (params));
+
+        ringFileDescriptor = (int)syscall (__NR_io_uring_setup, numEntries, &params);
+        if (ringFileDescriptor < 0)
+            return;
+
+        // a single mmap for both rings and waiting with a timeout are needed, both exist since Linux 5.11
+        if (((params.features & IORING_FEAT_SINGLE_MMAP) == 0) || ((params.features & IORING_FEAT_EXT_ARG) == 0)) {
+            closeRing();
+            return;
+        }
+
+        ringSize = params.sq_off.array + params.sq_entries * sizeof (uint32_t);
+        const size_t completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+        if (completionRingSize > ringSize)
+            ringSize = completionRingSize;
+
+        ringMemory = mmap (nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFileDescriptor, IORING_OFF_SQ_RING);
+        submissionEntriesSize = params.sq_entries * sizeof (io_uring_sqe);
+        void *entryMemory = mmap (nullptr, submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFileDescriptor, IORING_OFF_SQES);
+        if ((ringMemory == MAP_FAILED) || (entryMemory == MAP_FAILED)) {
+            if (ringMemory == MAP_FAILED)
+                ringMemory = nullptr;
+            if (entryMemory != MAP_FAILED)
+                munmap (entryMemory, submissionEntriesSize);
+            closeRing();
+            return;
+        }
+
+        uint8_t *ring = (uint8_t *)ringMemory;
+        submissionHead = (uint32_t *)(ring + params.sq_off.head);
+        submissionTail = (uint32_t *)(ring + params.sq_off.tail);
+        submissionMask = *(uint32_t *)(ring + params.sq_off.ring_mask);
+        submissionEntries = (io_uring_sqe *)entryMemory;
+        numSubmissionEntries = params.sq_entries;
+
+        completionHead = (uint32_t *)(ring + params.cq_off.head);
+        completionTail = (uint32_t *)(ring + params.cq_off.tail);
+        completionMask = *(uint32_t *)(ring + params.cq_off.ring_mask);
+        completionEntries = (io_uring_cqe *)(ring + params.cq_off.cqes);
+
+        // entry i of the submission queue always points to submission entry i
+        uint32_t *submissionArray = (uint32_t *)(ring + params.sq_off.array);
+        for (uint32_t i = 0; i < params.sq_entries; i++)
+            submissionArray[i] = i;
+
+        localSubmissionTail = *submissionTail;
+    }
+
+    ~IOUring() {
+        if (bufferRing != nullptr)
+            munmap (bufferRing, numProvidedBuffers * sizeof (io_uring_buf));
+        free (providedBufferMemory);
+        if (submissionEntries != nullptr)
+            munmap (submissionEntries, submissionEntriesSize);
+        closeRing();
+    }
+
+    bool isValid() const {
+        return ringFileDescriptor >= 0;
+    }
+
+    /** Asks the kernel if it knows the operation passed */
+    bool supportsOperation (uint8_t opcode) {
+        const size_t probeSize = sizeof (io_uring_probe) + 256 * sizeof (io_uring_probe_op);
+        io_uring_probe *probe = (io_uring_probe *)calloc (1, probeSize);
+        if (probe == nullptr)
+            return false;
+
+        bool supported = false;
+        if (syscall (__NR_io_uring_register, ringFileDescriptor, IORING_REGISTER_PROBE, probe, 256) == 0)
+            supported = (opcode <= probe->last_op) && (opcode < probe->ops_len) && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+
+        free (probe);
+        return supported;
+    }
+
+    /**
+     * Registers a ring of buffers that reads with IOSQE_BUFFER_SELECT pick from. Once the kernel has filled a
+     * buffer, it belongs to the application until it is given back with recycleProvidedBuffer().
+     * @param numBuffers    Must be a power of two
+     */
+    bool setupProvidedBuffers (uint16_t groupId, uint16_t numBuffers, uint32_t bufferSize) {
+        bufferRing = (io_uring_buf_ring *)mmap (nullptr, numBuffers * sizeof (io_uring_buf), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        providedBufferMemory = (uint8_t *)malloc ((size_t)numBuffers * bufferSize);
+        if ((bufferRing == MAP_FAILED) || (providedBufferMemory == nullptr)) {
+            if (bufferRing != MAP_FAILED)
+                munmap (bufferRing, numBuffers * sizeof (io_uring_buf));
+            bufferRing = nullptr;
+            return false;
+        }
+
+        io_uring_buf_reg registration;
+        memset (&registration, 0, sizeof (registration));
+        registration.ring_addr = (uint64_t)(uintptr_t)bufferRing;
+        registration.ring_entries = numBuffers;
+        registration.bgid = groupId;
+        if (syscall (__NR_io_uring_register, ringFileDescriptor, IORING_REGISTER_PBUF_RING, &registration, 1) != 0) {
+            munmap (bufferRing, numBuffers * sizeof (io_uring_buf));
+            bufferRing = nullptr;
+            return false;
+        }
+
+        numProvidedBuffers = numBuffers;
+        providedBufferSize = bufferSize;
+        bufferRingTail = 0;
+        for (uint16_t i = 0; i < numBuffers; i++)
+            recycleProvidedBuffer (i);
+        return true;
+    }
+
+    const uint8_t *getProvidedBuffer (uint16_t bufferId) const {
+        return providedBufferMemory + (size_t)bufferId * providedBufferSize;
+    }
+
+    void recycleProvidedBuffer (uint16_t bufferId) {
+        // The header declares the entries as a flexible array inside a union, which C++ compilers place behind an
+        // empty struct. The ring is therefore addressed as a plain array, with the tail in the first entry's resv
+        io_uring_buf *entries = (io_uring_buf *)bufferRing;
+        io_uring_buf &buffer = entries[bufferRingTail & (numProvidedBuffers - 1)];
+        buffer.addr = (uint64_t)(uintptr_t)getProvidedBuffer (bufferId);
+        buffer.len = providedBufferSize;
+        buffer.bid = bufferId;
+        bufferRingTail++;
+        __atomic_store_n (&entries[0].resv, bufferRingTail, __ATOMIC_RELEASE);
+    }
+
+    /** Returns a cleared submission entry, or nullptr if all entries are taken until the next submitAndWait() */
+    io_uring_sqe *getSubmissionEntry() {
+        const uint32_t head = __atomic_load_n (submissionHead, __ATOMIC_ACQUIRE);
+        if (localSubmissionTail - head >= numSubmissionEntries)
+            return nullptr;
+
+        io_uring_sqe *entry = &submissionEntries[localSubmissionTail & submissionMask];
+        memset (entry, 0, sizeof (io_uring_sqe));
+        localSubmissionTail++;
+        return entry;
+    }
+
+    /**
+     * Submits all entries taken since the last call and waits until at least minCompletions completions arrived
+     * or the timeout is over. Both happens in a single system call.
+     * @param timeoutInMilliseconds     -1 to wait without a timeout
+     * @return  The number of entries submitted, or a negative errno. -ETIME just means the timeout is over
+     */
+    int submitAndWait (unsigned minCompletions, int timeoutInMilliseconds) {
+        const uint32_t numToSubmit = localSubmissionTail - *submissionTail;
+        __atomic_store_n (submissionTail, localSubmissionTail, __ATOMIC_RELEASE);
+
+        unsigned flags = (minCompletions > 0) ? IORING_ENTER_GETEVENTS : 0;
+        io_uring_getevents_arg waitArguments;
+        __kernel_timespec timeout;
+        void *argument = nullptr;
+        size_t argumentSize = _NSIG / 8;
+
+        if ((minCompletions > 0) && (timeoutInMilliseconds >= 0)) {
+            timeout.tv_sec = timeoutInMilliseconds / 1000;
+            timeout.tv_nsec = (timeoutInMilliseconds % 1000) * 1000000LL;
+            memset (&waitArguments, 0, sizeof (waitArguments));
+            waitArguments.ts = (uint64_t)(uintptr_t)&timeout;
+            flags |= IORING_ENTER_EXT_ARG;
+            argument = &waitArguments;
+            argumentSize = sizeof (waitArguments);
+        }
+
+        int result = (int)syscall (__NR_io_uring_enter, ringFileDescriptor, numToSubmit, minCompletions, flags, argument, argumentSize);
+        return (result < 0) ? -errno : result;
+    }
+
+    /** Returns the next completion or nullptr. Call completionSeen() after handling it */
+    const io_uring_cqe *peekCompletion() const {
+        const uint32_t head = *completionHead;
+        if (head == __atomic_load_n (completionTail, __ATOMIC_ACQUIRE))
+            return nullptr;
+        return &completionEntries[head & completionMask];
+    }
+
+    void completionSeen() {
+        __atomic_store_n (completionHead, *completionHead + 1, __ATOMIC_RELEASE);
+    }
+
+private:
+
+    int ringFileDescriptor = -1;
+    void *ringMemory = nullptr;
+    size_t ringSize = 0;
+
+    uint32_t *submissionHead = nullptr;
+    uint32_t *submissionTail = nullptr;
+    uint32_t submissionMask = 0;
+    uint32_t localSubmissionTail = 0;
+    uint32_t numSubmissionEntries = 0;
+    io_uring_sqe *submissionEntries = nullptr;
+    size_t submissionEntriesSize = 0;
+
+    uint32_t *completionHead = nullptr;
+    uint32_t *completionTail = nullptr;
+    uint32_t completionMask = 0;
+    io_uring_cqe *completionEntries = nullptr;
+
+    io_uring_buf_ring *bufferRing = nullptr;
+    uint8_t *providedBufferMemory = nullptr;
+    uint16_t numProvidedBuffers = 0;
+    uint16_t bufferRingTail = 0;
+    uint32_t providedBufferSize = 0;
+
+    void closeRing() {
+        if (ringMemory != nullptr)
+            munmap (ringMemory, ringSize);
+        if (ringFileDescriptor >= 0)
+            close (ringFileDescriptor);
+
+        ringMemory = nullptr;
+        ringFileDescriptor = -1;
+    }
+};
+
+#endif /* IOUring_h */
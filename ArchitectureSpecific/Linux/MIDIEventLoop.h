@@ -0,0 +1,726 @@
+//
+//  MIDIEventLoop.h
+//
+//  One epoll or io_uring thread that receives from any number of MIDI ports and runs timers
+//
+
+#ifndef MIDIEventLoop_h
+#define MIDIEventLoop_h
+
+#include "../../simpleMIDI.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/prctl.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+// io_uring is available if the kernel headers know it. Define SIMPLE_MIDI_NO_IO_URING to build without it
+#if !defined SIMPLE_MIDI_NO_IO_URING && defined __has_include
+#if __has_include(<linux/io_uring.h>)
+#define SIMPLE_MIDI_IO_URING
+#include "IOUring.h"
+#endif
+#endif
+
+// Number of bytes sent from the io_uring loop thread that can wait for each port while the device is busy
+#ifndef SIMPLE_MIDI_EVENT_LOOP_MAX_STAGED_BYTES
+#define SIMPLE_MIDI_EVENT_LOOP_MAX_STAGED_BYTES 65536
+#endif
+
+
+/**
+ * Receives from many ports with a single thread instead of a receive thread per port. Pass the loop to the
+ * constructor of a TTYMIDIWrapper or VirtualMIDIPort and the port registers its file descriptor with the loop.
+ * The loop thread sleeps until any of the ports becomes readable, reads everything each ready port has buffered
+ * and passes it to the port's parser, so all receivedXYZ() callbacks of all ports attached are invoked from this
+ * one thread, one after another.
+ *
+ * Periodic jobs like MIDI clock or active sensing run on the same thread through timerfd timers. The kernel keeps
+ * their period, so they don't drift with the time the callbacks take.
+ *
+ * The loop waits with epoll by default. With the io_uring engine, available since Linux 6.7, tty ports are read by
+ * multishot reads into a ring of buffers provided to the kernel and bytes sent from the loop thread (e.g. by
+ * callbacks forwarding messages or by timers) are collected and written asynchronously. Everything a loop
+ * iteration needs is then submitted and waited for with one system call, instead of an epoll_wait, a read for
+ * each ready port and a write for each message sent. If io_uring can't be used, the loop falls back to epoll,
+ * getEngine() tells which one is running.
+ *
+ * Callbacks must not block and must not create or destroy ports or timers of their own loop. The loop has to
+ * outlive all ports attached to it.
+ */
+class MIDIEventLoop {
+
+public:
+
+    enum Engine : uint8_t {
+        EpollEngine,
+        IOUringEngine
+    };
+
+    /** Anything that can be woken up by the loop. Implemented by the ports that can be attached */
+    class Handler {
+    public:
+        virtual ~Handler() {}
+
+        /** Called from the loop thread when the file descriptor is readable. Return false to be removed */
+        virtual bool fileDescriptorReadable() = 0;
+
+        /**
+         * Return true to let the io_uring engine read the file descriptor and pass the bytes to bytesReceived()
+         * instead of calling fileDescriptorReadable(). The handler is removed if the read fails
+         */
+        virtual bool isByteStream() {
+            return false;
+        }
+
+        virtual void bytesReceived (const uint8_t *bytes, int length) {}
+
+        /** Milliseconds until timeoutExpired() should be called, or -1 if there is nothing to wait for */
+        virtual int getTimeout() {
+            return -1;
+        }
+
+        virtual void timeoutExpired() {}
+    };
+
+    /**
+     * Launches the loop thread. Check isRunning() to find out if the loop could be set up
+     * @param preferredEngine   The engine to wait with, epoll is used if io_uring is not available
+     */
+    MIDIEventLoop (Engine preferredEngine = EpollEngine) {
+        wakeUpFileDescriptor = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeUpFileDescriptor < 0)
+            return;
+
+#ifdef SIMPLE_MIDI_IO_URING
+        if ((preferredEngine == IOUringEngine) && setupIOUring()) {
+            engine = IOUringEngine;
+            loopThread = std::thread (&MIDIEventLoop::ioUringLoopWork, this);
+            loopThreadId = loopThread.get_id();
+            return;
+        }
+#endif
+
+        epollFileDescriptor = epoll_create1 (EPOLL_CLOEXEC);
+        if (epollFileDescriptor < 0) {
+            closeFileDescriptors();
+            return;
+        }
+
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = wakeUpFileDescriptor;
+        epoll_ctl (epollFileDescriptor, EPOLL_CTL_ADD, wakeUpFileDescriptor, &event);
+
+        loopThread = std::thread (&MIDIEventLoop::epollLoopWork, this);
+    }
+
+    ~MIDIEventLoop() {
+        if (loopThread.joinable()) {
+            loopThreadShouldExit = true;
+            wakeUp();
+            loopThread.join();
+        }
+
+#ifdef SIMPLE_MIDI_IO_URING
+        // the kernel is done with all buffers once the ring is gone
+        delete ring;
+        for (size_t i = 0; i < registrations.size(); i++)
+            delete registrations[i].writeInFlight;
+        for (size_t i = 0; i < orphanedWrites.size(); i++)
+            delete orphanedWrites[i];
+#endif
+
+        for (size_t i = 0; i < timers.size(); i++) {
+            close (timers[i]->timerFileDescriptor);
+            delete timers[i];
+        }
+        closeFileDescriptors();
+    }
+
+    bool isRunning() const {
+        return loopThread.joinable();
+    }
+
+    Engine getEngine() const {
+        return engine;
+    }
+
+    /**
+     * Calls the handler from the loop thread whenever the file descriptor becomes readable. The descriptor should
+     * be non-blocking and the handler should read everything available, the epoll engine is level triggered.
+     */
+    bool add (int fileDescriptor, Handler &handler) {
+        if (!isRunning() || (fileDescriptor < 0))
+            return false;
+
+        std::lock_guard<std::mutex> lock (handlerMutex);
+        if ((size_t)fileDescriptor >= registrations.size())
+            registrations.resize (fileDescriptor + 1);
+
+        Registration &registration = registrations[fileDescriptor];
+        if (registration.handler != nullptr)
+            return false;
+
+        if (engine == EpollEngine) {
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = fileDescriptor;
+            if (epoll_ctl (epollFileDescriptor, EPOLL_CTL_ADD, fileDescriptor, &event) != 0)
+                return false;
+        }
+#ifdef SIMPLE_MIDI_IO_URING
+        else {
+            // only the loop thread may touch the submission queue
+            registration.generation++;
+            registrationsToArm.push_back (fileDescriptor);
+        }
+#endif
+
+        registration.handler = &handler;
+        handlers.push_back (&handler);
+
+        // a new handler might need a shorter timeout than the loop is currently waiting for
+        wakeUp();
+        return true;
+    }
+
+    /**
+     * Stops watching the file descriptor. Once this returns, the handler is not called anymore and can be
+     * destroyed. Bytes sent from the loop thread that were not written yet are dropped. Must not be called from
+     * the loop thread.
+     */
+    void remove (int fileDescriptor) {
+        std::lock_guard<std::mutex> lock (handlerMutex);
+        removeLocked (fileDescriptor);
+    }
+
+    /**
+     * Called by the ports for everything they send. Bytes sent from the loop thread while the io_uring engine is
+     * running are collected and written asynchronously in order, in that case true is returned. Otherwise the
+     * port has to write the bytes itself. The loop thread never waits for a device: if more than
+     * SIMPLE_MIDI_EVENT_LOOP_MAX_STAGED_BYTES are waiting for a port, the new bytes are dropped and counted.
+     */
+    bool queueWrite (int fileDescriptor, const uint8_t *bytes, int length) {
+#ifdef SIMPLE_MIDI_IO_URING
+        if ((engine != IOUringEngine) || (std::this_thread::get_id() != loopThreadId))
+            return false;
+
+        // the loop thread holds the handler mutex while it calls the handlers
+        Registration &registration = registrations[fileDescriptor];
+        if (registration.handler == nullptr)
+            return false;
+
+        if (registration.stagedBytes.size() + length > SIMPLE_MIDI_EVENT_LOOP_MAX_STAGED_BYTES) {
+            numBytesDropped.fetch_add (length, std::memory_order_relaxed);
+            return true;
+        }
+
+        if (registration.stagedBytes.empty() && (registration.writeInFlight == nullptr))
+            registrationsWithStagedBytes.push_back (fileDescriptor);
+        registration.stagedBytes.insert (registration.stagedBytes.end(), bytes, bytes + length);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * Calls the callback from the loop thread every intervalInNanoseconds, starting one interval from now. If the
+     * loop falls behind, the callback is called once for each interval missed.
+     * @return  An id to pass to removeTimer() or -1 if the timer could not be created
+     */
+    int addTimer (uint64_t intervalInNanoseconds, std::function<void()> callback) {
+        if (intervalInNanoseconds == 0)
+            return -1;
+
+        int timerFileDescriptor = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerFileDescriptor < 0)
+            return -1;
+
+        itimerspec period;
+        period.it_interval.tv_sec = intervalInNanoseconds / 1000000000ULL;
+        period.it_interval.tv_nsec = intervalInNanoseconds % 1000000000ULL;
+        period.it_value = period.it_interval;
+        timerfd_settime (timerFileDescriptor, 0, &period, nullptr);
+
+        Timer *timer = new Timer;
+        timer->timerFileDescriptor = timerFileDescriptor;
+        timer->callback = callback;
+
+        if (!add (timerFileDescriptor, *timer)) {
+            close (timerFileDescriptor);
+            delete timer;
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> lock (handlerMutex);
+        timers.push_back (timer);
+        return timerFileDescriptor;
+    }
+
+    /** Stops and destroys the timer. Must not be called from the loop thread */
+    void removeTimer (int timerId) {
+        std::lock_guard<std::mutex> lock (handlerMutex);
+        for (size_t i = 0; i < timers.size(); i++) {
+            if (timers[i]->timerFileDescriptor != timerId)
+                continue;
+
+            removeLocked (timerId);
+            close (timerId);
+            delete timers[i];
+            timers.erase (timers.begin() + i);
+            return;
+        }
+    }
+
+    /** Sends an active sense message through the connection passed every intervalInMilliseconds */
+    int addActiveSenseTimer (SimpleMIDI &midiConnection, uint32_t intervalInMilliseconds = 270) {
+        return addTimer (intervalInMilliseconds * 1000000ULL, [&midiConnection] () {midiConnection.sendActiveSense();});
+    }
+
+    /** Sends 24 MIDI clock ticks per quarter note through the connection passed */
+    int addClockTimer (SimpleMIDI &midiConnection, double beatsPerMinute) {
+        if (beatsPerMinute <= 0)
+            return -1;
+        return addTimer ((uint64_t)(60000000000.0 / (beatsPerMinute * 24.0)), [&midiConnection] () {midiConnection.sendMIDIClockTick();});
+    }
+
+    /** Returns the number of bytes sent from the loop thread that were dropped because their port was too busy or gone */
+    uint64_t getNumBytesDropped() const {
+        return numBytesDropped.load (std::memory_order_relaxed);
+    }
+
+    size_t getNumHandlers() {
+        std::lock_guard<std::mutex> lock (handlerMutex);
+        return handlers.size();
+    }
+
+private:
+
+    struct Timer : public Handler {
+        int timerFileDescriptor;
+        std::function<void()> callback;
+
+        bool fileDescriptorReadable() override {
+            uint64_t numExpirations = 0;
+            if (read (timerFileDescriptor, &numExpirations, sizeof (numExpirations)) != sizeof (numExpirations))
+                return true;
+
+            for (uint64_t i = 0; i < numExpirations; i++)
+                callback();
+            return true;
+        }
+    };
+
+    // Bytes handed to the kernel by a write of the io_uring engine, they stay alive until the write completed
+    struct WriteRequest {
+        int fileDescriptor;
+        uint32_t generation;
+        std::vector<uint8_t> bytes;
+        size_t numBytesWritten;
+    };
+
+    struct Registration {
+        Handler *handler = nullptr;
+
+        // Everything below is only used by the io_uring engine. The generation tells completions of a removed
+        // handler apart from the ones of a new handler that got the same file descriptor
+        uint32_t generation = 0;
+        uint64_t activeOperation = 0;
+        std::vector<uint8_t> stagedBytes;
+        WriteRequest *writeInFlight = nullptr;
+    };
+
+    static const int maxEventsPerWakeUp = 64;
+
+    Engine engine = EpollEngine;
+    int epollFileDescriptor = -1;
+    int wakeUpFileDescriptor = -1;
+    std::thread loopThread;
+    std::atomic<bool> loopThreadShouldExit {false};
+    std::atomic<uint64_t> numBytesDropped {0};
+
+    // Guards the handler lists. The loop thread holds it while it calls the handlers of one wake up
+    std::mutex handlerMutex;
+    std::vector<Registration> registrations;
+    std::vector<Handler *> handlers;
+    std::vector<Timer *> timers;
+
+    void wakeUp() {
+        const uint64_t signal = 1;
+        ssize_t unused = write (wakeUpFileDescriptor, &signal, sizeof (signal));
+        (void)unused;
+    }
+
+    void removeLocked (int fileDescriptor) {
+        if ((fileDescriptor < 0) || ((size_t)fileDescriptor >= registrations.size()))
+            return;
+
+        Registration &registration = registrations[fileDescriptor];
+        Handler *handler = registration.handler;
+        if (handler == nullptr)
+            return;
+
+        if (engine == EpollEngine) {
+            epoll_ctl (epollFileDescriptor, EPOLL_CTL_DEL, fileDescriptor, nullptr);
+        }
+#ifdef SIMPLE_MIDI_IO_URING
+        else {
+            if (registration.activeOperation != 0) {
+                operationsToCancel.push_back (registration.activeOperation);
+                registration.activeOperation = 0;
+                if (std::this_thread::get_id() != loopThreadId)
+                    wakeUp();
+            }
+            if (registration.writeInFlight != nullptr) {
+                orphanedWrites.push_back (registration.writeInFlight);
+                registration.writeInFlight = nullptr;
+            }
+            registration.stagedBytes.clear();
+            registration.generation++;
+        }
+#endif
+
+        registration.handler = nullptr;
+        handlers.erase (std::find (handlers.begin(), handlers.end(), handler));
+    }
+
+    void closeFileDescriptors() {
+        if (epollFileDescriptor >= 0)
+            close (epollFileDescriptor);
+        if (wakeUpFileDescriptor >= 0)
+            close (wakeUpFileDescriptor);
+
+        epollFileDescriptor = -1;
+        wakeUpFileDescriptor = -1;
+    }
+
+    /** Calls the handlers whose timeout is over and returns the time until the next one is due */
+    int serviceTimeouts() {
+        int timeout = -1;
+        for (size_t i = 0; i < handlers.size(); i++) {
+            int handlerTimeout = handlers[i]->getTimeout();
+            if (handlerTimeout == 0) {
+                handlers[i]->timeoutExpired();
+                handlerTimeout = handlers[i]->getTimeout();
+            }
+            if ((handlerTimeout >= 0) && ((timeout < 0) || (handlerTimeout < timeout)))
+                timeout = handlerTimeout;
+        }
+        return timeout;
+    }
+
+    void epollLoopWork() {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::EventLoop);
+        // the timers are expected to fire on time, not up to 50 us late
+        prctl (PR_SET_TIMERSLACK, 1);
+
+        epoll_event events[maxEventsPerWakeUp];
+        int timeout = -1;
+
+        while (true) {
+            int numEvents = epoll_wait (epollFileDescriptor, events, maxEventsPerWakeUp, timeout);
+            if ((numEvents < 0) && (errno != EINTR))
+                return;
+
+            std::lock_guard<std::mutex> lock (handlerMutex);
+
+            for (int e = 0; e < numEvents; e++) {
+                const int fileDescriptor = events[e].data.fd;
+
+                if (fileDescriptor == wakeUpFileDescriptor) {
+                    uint64_t unused;
+                    ssize_t result = read (wakeUpFileDescriptor, &unused, sizeof (unused));
+                    (void)result;
+                    if (loopThreadShouldExit)
+                        return;
+                    continue;
+                }
+
+                // the handler might have been removed after epoll_wait returned
+                if ((size_t)fileDescriptor >= registrations.size())
+                    continue;
+                Handler *handler = registrations[fileDescriptor].handler;
+                if (handler == nullptr)
+                    continue;
+
+                if (!handler->fileDescriptorReadable())
+                    removeLocked (fileDescriptor);
+            }
+
+            timeout = serviceTimeouts();
+        }
+    }
+
+#ifdef SIMPLE_MIDI_IO_URING
+
+    // The kind of operation is stored in the lowest bits of the user data of each submission. Writes carry the
+    // address of their request, all others the file descriptor and the generation of its registration
+    enum OperationKind : uint64_t {
+        IgnoredOperation = 0,
+        ReadOperation = 1,
+        PollOperation = 2,
+        WriteOperation = 3,
+        OperationKindMask = 7
+    };
+
+    static const uint16_t receiveBufferGroup = 0;
+    static const uint16_t numReceiveBuffers = 256;
+    static const uint32_t receiveBufferSize = 1024;
+
+    IOUring *ring = nullptr;
+    std::thread::id loopThreadId;
+
+    // Work for the loop thread, added by other threads under the handler mutex
+    std::vector<int> registrationsToArm;
+    std::vector<uint64_t> operationsToCancel;
+
+    // Only used by the loop thread
+    std::vector<int> registrationsWithStagedBytes;
+    std::vector<WriteRequest *> orphanedWrites;
+
+    bool setupIOUring() {
+        ring = new IOUring (256);
+        if (ring->isValid()
+            && ring->supportsOperation (SIMPLE_MIDI_IORING_OP_READ_MULTISHOT)
+            && ring->supportsOperation (IORING_OP_POLL_ADD)
+            && ring->supportsOperation (IORING_OP_WRITE)
+            && ring->setupProvidedBuffers (receiveBufferGroup, numReceiveBuffers, receiveBufferSize))
+            return true;
+
+        delete ring;
+        ring = nullptr;
+        return false;
+    }
+
+    static uint64_t makeUserData (OperationKind kind, int fileDescriptor, uint32_t generation) {
+        return ((uint64_t)generation << 32) | ((uint64_t)fileDescriptor << 3) | kind;
+    }
+
+    io_uring_sqe *getSubmissionEntry() {
+        io_uring_sqe *entry = ring->getSubmissionEntry();
+        if (entry == nullptr) {
+            // the queue is full, hand everything to the kernel without waiting to make room
+            ring->submitAndWait (0, -1);
+            entry = ring->getSubmissionEntry();
+        }
+        return entry;
+    }
+
+    void arm (int fileDescriptor) {
+        Registration &registration = registrations[fileDescriptor];
+        if ((registration.handler == nullptr) || (registration.activeOperation != 0))
+            return;
+
+        io_uring_sqe *entry = getSubmissionEntry();
+        entry->fd = fileDescriptor;
+
+        if (registration.handler->isByteStream()) {
+            entry->opcode = SIMPLE_MIDI_IORING_OP_READ_MULTISHOT;
+            entry->flags = IOSQE_BUFFER_SELECT;
+            entry->buf_group = receiveBufferGroup;
+            entry->off = (uint64_t)-1;
+            registration.activeOperation = makeUserData (ReadOperation, fileDescriptor, registration.generation);
+        }
+        else {
+            entry->opcode = IORING_OP_POLL_ADD;
+            entry->len = IORING_POLL_ADD_MULTI;
+            entry->poll32_events = POLLIN;
+            registration.activeOperation = makeUserData (PollOperation, fileDescriptor, registration.generation);
+        }
+        entry->user_data = registration.activeOperation;
+    }
+
+    void armWakeUp() {
+        io_uring_sqe *entry = getSubmissionEntry();
+        entry->opcode = IORING_OP_POLL_ADD;
+        entry->fd = wakeUpFileDescriptor;
+        entry->len = IORING_POLL_ADD_MULTI;
+        entry->poll32_events = POLLIN;
+        entry->user_data = makeUserData (PollOperation, wakeUpFileDescriptor, 0);
+    }
+
+    void submitWrite (WriteRequest *request, bool waitUntilWritable) {
+        if (waitUntilWritable) {
+            // the driver's buffer is full, the write is linked behind a poll so that it starts once there is room
+            io_uring_sqe *poll = getSubmissionEntry();
+            poll->opcode = IORING_OP_POLL_ADD;
+            poll->fd = request->fileDescriptor;
+            poll->poll32_events = POLLOUT;
+            poll->flags = IOSQE_IO_LINK;
+            poll->user_data = IgnoredOperation;
+        }
+
+        io_uring_sqe *entry = getSubmissionEntry();
+        entry->opcode = IORING_OP_WRITE;
+        entry->fd = request->fileDescriptor;
+        entry->addr = (uint64_t)(uintptr_t)(request->bytes.data() + request->numBytesWritten);
+        entry->len = (uint32_t)(request->bytes.size() - request->numBytesWritten);
+        entry->off = (uint64_t)-1;
+        entry->user_data = (uint64_t)(uintptr_t)request | WriteOperation;
+    }
+
+    /** Turns the bytes collected for each port into a write, unless the previous one is still running */
+    void submitStagedWrites() {
+        for (size_t i = 0; i < registrationsWithStagedBytes.size(); i++) {
+            const int fileDescriptor = registrationsWithStagedBytes[i];
+            Registration &registration = registrations[fileDescriptor];
+            if ((registration.writeInFlight != nullptr) || registration.stagedBytes.empty())
+                continue;
+
+            WriteRequest *request = new WriteRequest;
+            request->fileDescriptor = fileDescriptor;
+            request->generation = registration.generation;
+            request->bytes.swap (registration.stagedBytes);
+            request->numBytesWritten = 0;
+            registration.writeInFlight = request;
+            submitWrite (request, false);
+        }
+        registrationsWithStagedBytes.clear();
+    }
+
+    void writeCompleted (WriteRequest *request, int result) {
+        Registration &registration = registrations[request->fileDescriptor];
+        if (registration.writeInFlight != request) {
+            // the port was removed while the write was running
+            orphanedWrites.erase (std::find (orphanedWrites.begin(), orphanedWrites.end(), request));
+            delete request;
+            return;
+        }
+
+        if (result > 0)
+            request->numBytesWritten += result;
+
+        // A tty write that has to wait for room runs in an io_uring worker thread and ends with EINTR if the worker
+        // is interrupted, that's no reason to give up on the bytes
+        const bool deviceBusy = (result == -EAGAIN) || (result == -EINTR);
+        if ((result > 0) || deviceBusy) {
+            if (request->numBytesWritten < request->bytes.size()) {
+                submitWrite (request, deviceBusy);
+                return;
+            }
+        }
+
+        // done, or the device is gone and the bytes can't be written anymore
+        numBytesDropped.fetch_add (request->bytes.size() - request->numBytesWritten, std::memory_order_relaxed);
+        if (!registration.stagedBytes.empty())
+            registrationsWithStagedBytes.push_back (request->fileDescriptor);
+        registration.writeInFlight = nullptr;
+        delete request;
+    }
+
+    void handleCompletion (const io_uring_cqe &completion) {
+        const uint64_t kind = completion.user_data & OperationKindMask;
+
+        if (kind == WriteOperation) {
+            writeCompleted ((WriteRequest *)(uintptr_t)(completion.user_data & ~(uint64_t)OperationKindMask), completion.res);
+            return;
+        }
+        if (kind == IgnoredOperation)
+            return;
+
+        const int fileDescriptor = (int)((completion.user_data >> 3) & 0x1FFFFFFF);
+        const uint32_t generation = (uint32_t)(completion.user_data >> 32);
+        const bool hasBuffer = (completion.flags & IORING_CQE_F_BUFFER) != 0;
+        const uint16_t bufferId = (uint16_t)(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+        const bool multishotEnded = (completion.flags & IORING_CQE_F_MORE) == 0;
+
+        if (fileDescriptor == wakeUpFileDescriptor) {
+            uint64_t unused;
+            ssize_t result = read (wakeUpFileDescriptor, &unused, sizeof (unused));
+            (void)result;
+            if (multishotEnded)
+                armWakeUp();
+            return;
+        }
+
+        Registration *registration = nullptr;
+        if (((size_t)fileDescriptor < registrations.size()) && (registrations[fileDescriptor].generation == generation)
+            && (registrations[fileDescriptor].handler != nullptr))
+            registration = &registrations[fileDescriptor];
+
+        if (registration != nullptr) {
+            if (kind == ReadOperation) {
+                if ((completion.res > 0) && hasBuffer)
+                    registration->handler->bytesReceived (ring->getProvidedBuffer (bufferId), completion.res);
+            }
+            else if ((completion.res > 0) && !registration->handler->fileDescriptorReadable()) {
+                removeLocked (fileDescriptor);
+                registration = nullptr;
+            }
+        }
+
+        if (hasBuffer)
+            ring->recycleProvidedBuffer (bufferId);
+
+        if ((registration == nullptr) || !multishotEnded)
+            return;
+
+        registration->activeOperation = 0;
+
+        // multishot operations end if the buffers ran out or the file was closed. In the first case, just start over
+        if ((completion.res > 0) || (completion.res == -ENOBUFS))
+            arm (fileDescriptor);
+        else
+            removeLocked (fileDescriptor);
+    }
+
+    void ioUringLoopWork() {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::EventLoop);
+        // the timers are expected to fire on time, not up to 50 us late
+        prctl (PR_SET_TIMERSLACK, 1);
+
+        int timeout = -1;
+
+        {
+            std::lock_guard<std::mutex> lock (handlerMutex);
+            armWakeUp();
+        }
+
+        while (true) {
+            int result = ring->submitAndWait (1, timeout);
+            if ((result < 0) && (result != -ETIME) && (result != -EINTR) && (result != -EBUSY))
+                return;
+
+            std::lock_guard<std::mutex> lock (handlerMutex);
+
+            while (const io_uring_cqe *completion = ring->peekCompletion()) {
+                const io_uring_cqe copy = *completion;
+                ring->completionSeen();
+                handleCompletion (copy);
+            }
+
+            if (loopThreadShouldExit)
+                return;
+
+            for (size_t i = 0; i < operationsToCancel.size(); i++) {
+                io_uring_sqe *entry = getSubmissionEntry();
+                entry->opcode = IORING_OP_ASYNC_CANCEL;
+                entry->addr = operationsToCancel[i];
+                entry->user_data = IgnoredOperation;
+            }
+            operationsToCancel.clear();
+
+            for (size_t i = 0; i < registrationsToArm.size(); i++)
+                arm (registrationsToArm[i]);
+            registrationsToArm.clear();
+
+            timeout = serviceTimeouts();
+            submitStagedWrites();
+        }
+    }
+
+#endif
+};
+
+#endif /* MIDIEventLoop_h */
@@ -0,0 +1,24 @@
+//
+//  TTYMIDIWrapperDef.h
+//
+//  Serial MIDI I/O through a Linux tty device (UART, USB-serial adapter or pseudo-terminal)
+//
+
+#ifndef TTYMIDIWrapperDef_h
+#define TTYMIDIWrapperDef_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class TTYMIDIWrapper;
+
+
+// Groups the path of a tty device with the baud rate it should be opened with. The 31250 baud of a
+// 5-pin DIN connection is the default, USB-serial bridges often use 38400 or 115200 instead
+typedef struct {
+    std::string deviceName;
+    uint32_t baudRate = 31250;
+} TTYMIDIDeviceRessource;
+
+#endif /* TTYMIDIWrapperDef_h */
@@ -0,0 +1,529 @@
+//
+//  TTYMIDIWrapperImpl.h
+//
+//  Serial MIDI I/O through a Linux tty device (UART, USB-serial adapter or pseudo-terminal)
+//
+
+#ifndef TTYMIDIWrapperImpl_h
+#define TTYMIDIWrapperImpl_h
+
+#include "TTYMIDIWrapperDef.h"
+#include "../../simpleMIDI.h"
+#include "MIDIEventLoop.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <cstring>
+#include <thread>
+#include <atomic>
+
+#ifdef TCGETS2
+// The kernel's <asm/termbits.h> redefines struct termios and most macros of glibc's <termios.h>, so it can't be
+// included next to it. <sys/ioctl.h> still defines TCGETS2 and TCSETS2 with the ioctl numbers of the architecture,
+// they only need the struct they refer to. Its layout is the same on all architectures that have it except for
+// the size of c_cc, powerpc and alpha have no termios2 and use the fallbacks in TTYMIDIWrapper::setBaudRate()
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+#ifdef __mips__
+    cc_t c_cc[23];
+#else
+    cc_t c_cc[19];
+#endif
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#endif
+
+class TTYMIDIWrapper : public SimpleMIDI, private MIDIEventLoop::Handler {
+
+public:
+
+    /**
+     * Opens the tty device in raw mode with the baud rate requested by the device ressource and launches a
+     * receive thread. The thread sleeps in epoll_wait until bytes arrive, so all receivedXYZ() callbacks will
+     * be invoked from this thread. Check isOpen() to find out if the device could be opened and configured.
+     */
+    TTYMIDIWrapper (TTYMIDIDeviceRessource &selectedDevice) {
+        if (!openDevice (selectedDevice))
+            return;
+
+        epollFileDescriptor = epoll_create1 (EPOLL_CLOEXEC);
+        exitEventFileDescriptor = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if ((epollFileDescriptor < 0) || (exitEventFileDescriptor < 0)) {
+            closeDevice ();
+            return;
+        }
+
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = ttyFileDescriptor;
+        epoll_ctl (epollFileDescriptor, EPOLL_CTL_ADD, ttyFileDescriptor, &event);
+        event.data.fd = exitEventFileDescriptor;
+        epoll_ctl (epollFileDescriptor, EPOLL_CTL_ADD, exitEventFileDescriptor, &event);
+
+        receiveThread = std::thread (&TTYMIDIWrapper::receiveThreadWork, this);
+    };
+
+    /**
+     * Opens the tty device like the constructor above, but receives through the event loop passed instead of a
+     * receive thread of its own. All receivedXYZ() callbacks will be invoked from the loop's thread.
+     */
+    TTYMIDIWrapper (TTYMIDIDeviceRessource &selectedDevice, MIDIEventLoop &eventLoopToUse) {
+        if (!openDevice (selectedDevice))
+            return;
+
+        // set before adding, the loop might call the port right away
+        eventLoop = &eventLoopToUse;
+        if (!eventLoopToUse.add (ttyFileDescriptor, *this)) {
+            eventLoop = nullptr;
+            closeDevice ();
+        }
+    };
+
+    ~TTYMIDIWrapper () override {
+        // the thinning and send threads need the device until everything queued was written
+        setOutputThinning (false);
+        setThreadSafeSending (false);
+
+        if (receiveThread.joinable ()) {
+            // wake the receive thread up, it will leave its loop as soon as it sees the exit event or the flag
+            receiveThreadShouldExit.store (true, std::memory_order_relaxed);
+            const uint64_t exitSignal = 1;
+            ssize_t unused = write (exitEventFileDescriptor, &exitSignal, sizeof (exitSignal));
+            (void)unused;
+            receiveThread.join ();
+        }
+        if (eventLoop != nullptr)
+            eventLoop->remove (ttyFileDescriptor);
+        closeDevice ();
+    };
+
+    /** Returns true if the tty device was opened and configured successfully */
+    bool isOpen () const {
+        return ttyFileDescriptor >= 0;
+    }
+
+    /**
+     * Returns all serial devices found in /dev that could carry MIDI: on-board UARTs, USB-serial adapters and
+     * USB CDC-ACM devices. Pseudo-terminals are not listed, pass their path directly if you want to use one.
+     */
+    static const std::vector<TTYMIDIDeviceRessource> searchMIDIDevices () {
+        std::vector<TTYMIDIDeviceRessource> allDevices;
+
+        DIR *devDirectory = opendir ("/dev");
+        if (devDirectory == NULL)
+            return allDevices;
+
+        const char *serialDevicePrefixes[] = {"ttyAMA", "ttyS", "ttyUSB", "ttyACM", "serial"};
+
+        while (dirent *entry = readdir (devDirectory)) {
+            for (const char *prefix : serialDevicePrefixes) {
+                if (strncmp (entry->d_name, prefix, strlen (prefix)) != 0)
+                    continue;
+
+                TTYMIDIDeviceRessource d;
+                d.deviceName = std::string ("/dev/") + entry->d_name;
+                if (hasSerialHardware (d.deviceName))
+                    allDevices.push_back (d);
+                break;
+            }
+        }
+        closedir (devDirectory);
+
+        return allDevices;
+    }
+
+    /**
+     * Trades a CPU core for lower input latency. After each burst of bytes, the receive thread keeps polling the
+     * device with non-blocking reads for the time passed before it goes back to sleep in epoll_wait. Bytes that
+     * arrive while it spins are picked up without waiting for the kernel to wake the thread up. Every burst caught
+     * restarts the spin, so under steady traffic the thread doesn't sleep at all. This is what the receive()
+     * function of the Arduino wrapper does all the time.
+     * Only affects ports with a receive thread of their own, not those served by a MIDIEventLoop.
+     * @param spinTimeInMicroseconds    0 to always sleep right away, which is the default
+     */
+    void setBusyPolling (uint32_t spinTimeInMicroseconds) {
+        busyPollTime.store (spinTimeInMicroseconds, std::memory_order_relaxed);
+    }
+
+    uint32_t getBusyPolling () const {
+        return busyPollTime.load (std::memory_order_relaxed);
+    }
+
+    struct ReceiveStatistics {
+        /** Number of bursts the thread had to be woken up for, each of them took a full scheduler wake-up */
+        uint64_t numWakeUps;
+
+        /** Number of bursts that were caught while spinning, without a wake-up */
+        uint64_t numBurstsCaughtSpinning;
+
+        /** Total time spent spinning, this is the CPU time busy polling costs */
+        uint64_t nanosecondsSpentSpinning;
+
+        /**
+         * Measured wake-up latency of the bursts caught spinning: the average time between two polls. A burst
+         * waits at most this long before it is read. Woken up bursts wait for the scheduler instead, which takes
+         * some microseconds on an idle core and far more on a loaded one. 0 if nothing was caught yet.
+         */
+        uint64_t averagePollIntervalNanoseconds;
+    };
+
+    /** Shows how often busy polling saved a wake-up and what it cost. Can be called from any thread */
+    ReceiveStatistics getReceiveStatistics () const {
+        ReceiveStatistics statistics;
+        statistics.numWakeUps = numWakeUps.load (std::memory_order_relaxed);
+        statistics.numBurstsCaughtSpinning = numBurstsCaughtSpinning.load (std::memory_order_relaxed);
+        statistics.nanosecondsSpentSpinning = nanosecondsSpentSpinning.load (std::memory_order_relaxed);
+
+        const uint64_t polls = numPolls.load (std::memory_order_relaxed);
+        statistics.averagePollIntervalNanoseconds = (polls > 0) ? statistics.nanosecondsSpentSpinning / polls : 0;
+        return statistics;
+    }
+
+protected:
+    int ttyFileDescriptor = -1;
+    int epollFileDescriptor = -1;
+    int exitEventFileDescriptor = -1;
+    MIDIEventLoop *eventLoop = nullptr;
+
+    void writeRawMIDIBytes (const uint8_t *bytesToWrite, int length) override {
+        if (ttyFileDescriptor < 0)
+            return;
+
+        // bytes sent from the thread of an io_uring event loop are written by the loop
+        if ((eventLoop != nullptr) && eventLoop->queueWrite (ttyFileDescriptor, bytesToWrite, length))
+            return;
+
+        // The descriptor is non-blocking because the receive thread shares it. If the driver's transmit
+        // buffer is full, wait until it can take more bytes instead of spinning
+        while (length > 0) {
+            ssize_t written = write (ttyFileDescriptor, bytesToWrite, length);
+            if (written > 0) {
+                bytesToWrite += written;
+                length -= written;
+            }
+            else if ((written < 0) && (errno == EAGAIN)) {
+                pollfd writable;
+                writable.fd = ttyFileDescriptor;
+                writable.events = POLLOUT;
+                ::poll (&writable, 1, -1);
+            }
+            else if ((written < 0) && (errno == EINTR)) {
+                continue;
+            }
+            else {
+                return;
+            }
+        }
+    };
+
+
+    std::thread receiveThread;
+
+    // Everything needed for receiving
+    static const int receiveBufferSize = 1024;
+    uint8_t receiveBuffer[receiveBufferSize];
+
+    std::atomic<bool> receiveThreadShouldExit {false};
+    std::atomic<uint32_t> busyPollTime {0};
+    std::atomic<uint64_t> numWakeUps {0};
+    std::atomic<uint64_t> numBurstsCaughtSpinning {0};
+    std::atomic<uint64_t> nanosecondsSpentSpinning {0};
+    std::atomic<uint64_t> numPolls {0};
+
+    void receiveThreadWork () {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::Receive);
+        epoll_event events[2];
+
+        while (true) {
+            // combined messages whose LSB didn't arrive in time are passed on when the wait times out
+            int numEvents = epoll_wait (epollFileDescriptor, events, 2, getParameterAssemblyTimeout());
+            expireParameterAssembly();
+
+            if (numEvents < 0) {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+
+            for (int e = 0; e < numEvents; e++) {
+                if (events[e].data.fd == exitEventFileDescriptor)
+                    return;
+
+                numWakeUps.fetch_add (1, std::memory_order_relaxed);
+                if (!readAvailableBytes ())
+                    return;
+                if (!spinForNextBurst ())
+                    return;
+            }
+        }
+    }
+
+    /**
+     * Keeps reading until no byte arrived for the busy poll time. Returns false if the device is gone or the
+     * thread should exit. Only the receive thread updates the statistics, relaxed stores are enough for them
+     */
+    bool spinForNextBurst () {
+        const uint64_t spinTime = (uint64_t)busyPollTime.load (std::memory_order_relaxed) * 1000;
+        if (spinTime == 0)
+            return true;
+
+        const uint64_t spinStart = MIDITimestamp::now();
+        uint64_t lastBurst = spinStart;
+        uint64_t now = spinStart;
+        uint64_t polls = 0;
+        uint64_t burstsCaught = 0;
+        bool deviceIsAvailable = true;
+
+        while ((now - lastBurst < spinTime) && !receiveThreadShouldExit.load (std::memory_order_relaxed)) {
+            ssize_t numBytesRead = read (ttyFileDescriptor, receiveBuffer, receiveBufferSize);
+            now = MIDITimestamp::now();
+            polls++;
+
+            if (numBytesRead > 0) {
+                receiveTimestamp = now;
+                receiveParser.feed (*this, receiveBuffer, numBytesRead);
+                // under steady traffic the thread doesn't get back to epoll_wait, so combined messages expire here
+                expireParameterAssembly();
+                burstsCaught++;
+                now = MIDITimestamp::now();
+                lastBurst = now;
+            }
+            else if ((numBytesRead == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+                deviceIsAvailable = false;
+                break;
+            }
+        }
+
+        numPolls.store (numPolls.load (std::memory_order_relaxed) + polls, std::memory_order_relaxed);
+        numBurstsCaughtSpinning.store (numBurstsCaughtSpinning.load (std::memory_order_relaxed) + burstsCaught, std::memory_order_relaxed);
+        nanosecondsSpentSpinning.store (nanosecondsSpentSpinning.load (std::memory_order_relaxed) + (now - spinStart), std::memory_order_relaxed);
+        return deviceIsAvailable && !receiveThreadShouldExit.load (std::memory_order_relaxed);
+    }
+
+    /**
+     * Drains everything the driver has buffered and passes it to the parser. Returns false if the device is gone
+     * (e.g. an USB adapter was unplugged) and there is nothing left to wait for
+     */
+    bool readAvailableBytes () {
+        while (true) {
+            ssize_t numBytesRead = read (ttyFileDescriptor, receiveBuffer, receiveBufferSize);
+            if (numBytesRead > 0) {
+                receiveTimestamp = MIDITimestamp::now();
+                receiveParser.feed (*this, receiveBuffer, numBytesRead);
+                continue;
+            }
+            if ((numBytesRead < 0) && (errno == EINTR))
+                continue;
+            if ((numBytesRead < 0) && (errno == EAGAIN))
+                return true;
+
+            return false;
+        }
+    }
+
+private:
+
+    /**
+     * Looks the device up in sysfs instead of opening it. Opening a tty raises DTR, which resets boards like the
+     * Arduino Uno that are connected through their USB-serial bridge. Most PCs also expose a bunch of ttyS devices
+     * without any UART behind them, serial core reports their port type as 0, which is PORT_UNKNOWN.
+     */
+    static bool hasSerialHardware (const std::string &devicePath) {
+        // Resolves links like /dev/serial0 on the Raspberry Pi to the tty they point to
+        char *resolvedPath = realpath (devicePath.c_str (), NULL);
+        if (resolvedPath == NULL)
+            return false;
+        const char *name = strrchr (resolvedPath, '/') + 1;
+        const std::string sysfsPath = std::string ("/sys/class/tty/") + name;
+        free (resolvedPath);
+
+        if (access ((sysfsPath + "/device").c_str (), F_OK) != 0)
+            return false;
+
+        // USB-serial and CDC-ACM devices have no port type, they are backed by hardware as long as they exist
+        FILE *typeFile = fopen ((sysfsPath + "/type").c_str (), "r");
+        if (typeFile == NULL)
+            return true;
+        int portType = 0;
+        const bool typeRead = fscanf (typeFile, "%d", &portType) == 1;
+        fclose (typeFile);
+        return !typeRead || (portType != 0);
+    }
+
+    bool fileDescriptorReadable () override {
+        bool deviceIsAvailable = readAvailableBytes ();
+        expireParameterAssembly ();
+        return deviceIsAvailable;
+    }
+
+    bool isByteStream () override {
+        return true;
+    }
+
+    void bytesReceived (const uint8_t *bytes, int length) override {
+        receiveTimestamp = MIDITimestamp::now();
+        receiveParser.feed (*this, bytes, length);
+        expireParameterAssembly ();
+    }
+
+    int getTimeout () override {
+        return getParameterAssemblyTimeout ();
+    }
+
+    void timeoutExpired () override {
+        expireParameterAssembly ();
+    }
+
+    bool openDevice (TTYMIDIDeviceRessource &selectedDevice) {
+        ttyFileDescriptor = open (selectedDevice.deviceName.c_str (), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (ttyFileDescriptor < 0)
+            return false;
+
+        if (!configureRawMode () || !setBaudRate (selectedDevice.baudRate)) {
+            closeDevice ();
+            return false;
+        }
+
+        // throw away everything that was received before the port was opened
+        tcflush (ttyFileDescriptor, TCIOFLUSH);
+        return true;
+    }
+
+    bool configureRawMode () {
+        termios settings;
+        if (tcgetattr (ttyFileDescriptor, &settings) != 0)
+            return false;
+
+        cfmakeraw (&settings);
+        // 8N1, no modem control lines and no hardware flow control, a MIDI link has none of them
+        settings.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+        settings.c_cflag |= CLOCAL | CREAD;
+        settings.c_iflag &= ~(IXON | IXOFF | IXANY);
+        settings.c_cc[VMIN] = 1;
+        settings.c_cc[VTIME] = 0;
+
+        return tcsetattr (ttyFileDescriptor, TCSANOW, &settings) == 0;
+    }
+
+    /**
+     * Tries the ways to set a baud rate from the most to the least flexible one: termios2 takes any rate, the
+     * standard termios speeds cover the usual USB-serial rates and a custom divisor on the UART's base clock
+     * covers 31250 baud on drivers that predate termios2.
+     */
+    bool setBaudRate (uint32_t baudRate) {
+#ifdef TCGETS2
+        if (setBaudRateWithTermios2 (baudRate))
+            return true;
+#endif
+        const speed_t speed = standardSpeed (baudRate);
+        if (speed != B0)
+            return setSpeed (speed);
+
+        return setBaudRateWithCustomDivisor (baudRate);
+    }
+
+#ifdef TCGETS2
+    // The kernel's BOTHER and IBSHIFT. glibc doesn't define them, but its CBAUDEX has the value of BOTHER on all
+    // architectures with termios2 and the input speed bits are 16 bits above the output speed bits on all of them
+    static const tcflag_t termios2OtherBaud = CBAUDEX;
+    static const int termios2InputSpeedShift = 16;
+
+    bool setBaudRateWithTermios2 (uint32_t baudRate) {
+        termios2 settings;
+        if (ioctl (ttyFileDescriptor, TCGETS2, &settings) != 0)
+            return false;
+
+        settings.c_cflag &= ~(CBAUD | (CBAUD << termios2InputSpeedShift));
+        settings.c_cflag |= termios2OtherBaud | (termios2OtherBaud << termios2InputSpeedShift);
+        settings.c_ispeed = baudRate;
+        settings.c_ospeed = baudRate;
+
+        if (ioctl (ttyFileDescriptor, TCSETS2, &settings) != 0)
+            return false;
+
+        // Drivers without support for arbitrary rates silently pick the closest standard rate instead
+        return (ioctl (ttyFileDescriptor, TCGETS2, &settings) == 0) && (settings.c_ospeed == baudRate);
+    }
+#endif
+
+    bool setBaudRateWithCustomDivisor (uint32_t baudRate) {
+        serial_struct serial;
+        if ((ioctl (ttyFileDescriptor, TIOCGSERIAL, &serial) != 0) || (serial.baud_base <= 0) || (baudRate == 0))
+            return false;
+
+        const int divisor = (int)((serial.baud_base + baudRate / 2) / baudRate);
+        if (divisor == 0)
+            return false;
+
+        // MIDI receivers tolerate about 1% of deviation from the nominal rate
+        const uint32_t actualRate = (uint32_t)serial.baud_base / (uint32_t)divisor;
+        const uint32_t deviation = (actualRate > baudRate) ? actualRate - baudRate : baudRate - actualRate;
+        if (deviation * 100 > baudRate)
+            return false;
+
+        serial.flags = (serial.flags & ~ASYNC_SPD_MASK) | ASYNC_SPD_CUST;
+        serial.custom_divisor = divisor;
+        if (ioctl (ttyFileDescriptor, TIOCSSERIAL, &serial) != 0)
+            return false;
+
+        // With ASYNC_SPD_CUST set, the driver replaces 38400 baud by the custom rate
+        return setSpeed (B38400);
+    }
+
+    bool setSpeed (speed_t speed) {
+        termios settings;
+        if (tcgetattr (ttyFileDescriptor, &settings) != 0)
+            return false;
+
+        cfsetispeed (&settings, speed);
+        cfsetospeed (&settings, speed);
+        return tcsetattr (ttyFileDescriptor, TCSANOW, &settings) == 0;
+    }
+
+    static speed_t standardSpeed (uint32_t baudRate) {
+        switch (baudRate) {
+            case 9600:    return B9600;
+            case 19200:   return B19200;
+            case 38400:   return B38400;
+            case 57600:   return B57600;
+            case 115200:  return B115200;
+            case 230400:  return B230400;
+            case 460800:  return B460800;
+            case 500000:  return B500000;
+            case 921600:  return B921600;
+            case 1000000: return B1000000;
+            default:      return B0;
+        }
+    }
+
+    void closeDevice () {
+        if (ttyFileDescriptor >= 0)
+            close (ttyFileDescriptor);
+        if (epollFileDescriptor >= 0)
+            close (epollFileDescriptor);
+        if (exitEventFileDescriptor >= 0)
+            close (exitEventFileDescriptor);
+
+        ttyFileDescriptor = -1;
+        epollFileDescriptor = -1;
+        exitEventFileDescriptor = -1;
+    }
+
+};
+
+#endif /* TTYMIDIWrapperImpl_h */
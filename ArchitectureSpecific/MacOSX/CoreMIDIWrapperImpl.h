@@ -33,10 +33,16 @@ public:
         void *myRefCon = this;
         MIDIPortConnectSource (inputPort, source, myRefCon);
 
+        // CoreMIDI packets have to start with a status byte
+        supportsRunningStatus = false;
+
     };
 
 
     ~CoreMIDIWrapper () override {
+        // the thinning and send threads need the output port until everything queued was written
+        setOutputThinning (false);
+        setThreadSafeSending (false);
         MIDIPortDisconnectSource (inputPort, source);
     };
 
@@ -85,252 +91,17 @@ public:
         return allDevices;
     }
 
-
-    //Sending Data
-    inline RetValue sendNote (uint8_t note, uint8_t velocity, bool onOff) {
-        return sendNote (note, velocity, onOff, sendChannel);
-    };
-
-    RetValue sendNote (uint8_t note, uint8_t velocity, bool onOff, Channel channel) override {
-        //Check if values are 7Bit as the MIDI Standard requires
-        if ((note >> 7) == 1)
-            return FirstArgumentOutOfRange;
-        if ((velocity >> 7) == 1)
-            return SecondArgumentOutOfRange;
-
-        //Create MIDI Data
-        uint8_t dataToSend[3];
-
-        if (onOff == NoteOn) {
-            dataToSend[0] = NoteOnCmd << 4 | channel;
-            dataToSend[1] = note;
-            dataToSend[2] = velocity;
-        } else {
-            dataToSend[0] = NoteOffCmd << 4 | channel;
-            dataToSend[1] = note;
-            dataToSend[2] = velocity;
-        }
-
-        //Send MIDI Data
-        this->sendRawMIDIBuffer (dataToSend, 3);
-
-        return Success;
-    };
-
-    inline RetValue sendAftertouchEvent (uint8_t note, uint8_t velocity) {
-        return sendAftertouchEvent (note, velocity, sendChannel);
-    };
-
-    RetValue sendAftertouchEvent (uint8_t note, uint8_t velocity, Channel channel) override {
-        if ((velocity >> 7) == 1)
-            return SecondArgumentOutOfRange;
-
-        // check if it is a monophonic aftertouch
-        if (note == MonophonicAftertouch) {
-            uint8_t dataToSend[2];
-            dataToSend[0] = MonophonicAftertouchCmd << 4 | channel;
-            dataToSend[1] = velocity;
-            this->sendRawMIDIBuffer (dataToSend, 2);
-        }
-            // if not, check if the note is inside the range
-        else if ((note >> 7) == 1)
-            return FirstArgumentOutOfRange;
-        else {
-            uint8_t dataToSend[3];
-            dataToSend[0] = PolyphonicAftertouchCmd << 4 | channel;
-            dataToSend[1] = note;
-            dataToSend[2] = velocity;
-            this->sendRawMIDIBuffer (dataToSend, 3);
-        }
-
-        return Success;
-    };
-
-    inline RetValue sendControlChange (uint8_t control, uint8_t value) {
-        return sendControlChange (control, value, sendChannel);
-    };
-
-    RetValue sendControlChange (uint8_t control, uint8_t value, Channel channel) override {
-        //Check if values are 7Bit as the MIDI Standard requires
-        if ((control >> 7) == 1)
-            return FirstArgumentOutOfRange;
-        if ((value >> 7) == 1)
-            return SecondArgumentOutOfRange;
-
-        //Create MIDI Data
-        uint8_t dataToSend[3];
-        dataToSend[0] = ControlChangeCmd << 4 | channel;
-        dataToSend[1] = control;
-        dataToSend[2] = value;
-
-        //Send MIDI Data
-        this->sendRawMIDIBuffer (dataToSend, 3);
-
-        return Success;
-    };
-
-    inline RetValue sendProgramChange (uint8_t program) {
-        return sendProgramChange (program, sendChannel);
-    };
-
-    RetValue sendProgramChange (uint8_t program, Channel channel) override {
-        //Check if values are 7Bit as the MIDI Standard requires
-        if ((program >> 7) == 1)
-            return FirstArgumentOutOfRange;
-
-        //Create MIDI Data
-        uint8_t dataToSend[2];
-        dataToSend[0] = ProgrammChangeCmd << 4 | channel;
-        dataToSend[1] = program;
-
-        //Send MIDI Data
-        this->sendRawMIDIBuffer (dataToSend, 2);
-
-        return Success;
-    };
-
-    // todo: check if this works as expected
-    RetValue sendPitchBend (int16_t pitch) override {
-
-        // the input value is biased arround 0, so an offset has to be applied to get it into the range
-        // from 0 - 2^14 as the "wire format" defines
-        int16_t offset = 1 << 13;
-
-        // check if input is in range
-        if (pitch > offset)
-            return SecondArgumentOutOfRange;
-        if (pitch < -offset)
-            return SecondArgumentOutOfRange;
-
-        // should be positive after this operation
-        pitch += offset;
-
-        // lower 7 bit
-        const int16_t lsb = pitch & 0x7F;
-        // upper 7 bit
-        const int16_t msb = pitch >> 7;
-
-        uint8_t dataToSend[3];
-        dataToSend[0] = PitchBendCmd;
-        dataToSend[1] = lsb;
-        dataToSend[2] = msb;
-
-        this->sendRawMIDIBuffer (dataToSend, 3);
-
-        return Success;
-
-    }
-
-    //SysEx Messages must be framed by SYSEX_BEGIN and SYSEX_END
-    RetValue sendSysEx (const char *sysExBuffer, uint16_t length) override {
-        if (sysExBuffer[0] == SysExBegin) {
-            if (sysExBuffer[length - 1] == SysExEnd) {
-                sendRawMIDIBuffer ((uint8_t *) sysExBuffer, length);
-                return Success;
-            }
-            return MissingSysExEnd;
-        }
-        return MissingSysExStart;
-    };
-
-    RetValue sendMIDITimecodeQuarterFrame (uint8_t quarterFrame) override {
-        //Check if values are 7Bit as the MIDI Standard requires
-        if ((quarterFrame >> 7) == 1)
-            return FirstArgumentOutOfRange;
-
-        //Create MIDI Data
-        uint8_t dataToSend[2];
-        dataToSend[0] = MIDITimecodeQuarterFrame;
-        dataToSend[1] = quarterFrame;
-
-        //Send MIDI Data
-        this->sendRawMIDIBuffer (dataToSend, 2);
-
-        return Success;
-    };
-
-    RetValue sendMIDISongPositionPointer (uint16_t positionInBeats) override {
-        // positionInBeats has to be a 14 Bit int
-        if ((positionInBeats >> 14) != 0) {
-            return FirstArgumentOutOfRange;
-        }
-        // lower 7 bit
-        const uint16_t lsb = positionInBeats & 0x7F;
-        // upper 7 bit
-        const uint16_t msb = positionInBeats >> 7;
-
-        uint8_t dataToSend[3];
-        dataToSend[0] = SongPositionPointerCmd;
-        dataToSend[1] = lsb;
-        dataToSend[2] = msb;
-
-        this->sendRawMIDIBuffer (dataToSend, 3);
-
-        return Success;
-    };
-
-    RetValue sendSongSelect (uint8_t songToSelect) override {
-        //Check if values are 7Bit as the MIDI Standard requires
-        if ((songToSelect >> 7) == 1)
-            return FirstArgumentOutOfRange;
-
-        //Create MIDI Data
-        uint8_t dataToSend[2];
-        dataToSend[0] = SongSelectCmd;
-        dataToSend[1] = songToSelect;
-
-        //Send MIDI Data
-        this->sendRawMIDIBuffer (dataToSend, 2);
-
-        return Success;
-    };
-
-    void sendTuneRequest() override {
-        uint8_t cmd = TuneRequest;
-        sendRawMIDIBuffer (&cmd, 1);
-    };
-
-    void sendMIDIClockTick() override {
-        uint8_t cmd = ClockTickCmd;
-        this->sendRawMIDIBuffer (&cmd, 1);
-    };
-
-    void sendMIDIStart() override {
-        uint8_t cmd = StartCmd;
-        this->sendRawMIDIBuffer (&cmd, 1);
-    };
-
-    void sendMIDIStop() override {
-        uint8_t cmd = StopCmd;
-        this->sendRawMIDIBuffer (&cmd, 1);
-    };
-
-    void sendMIDIContinue() override {
-        uint8_t cmd = ContinueCmd;
-        this->sendRawMIDIBuffer (&cmd, 1);
-    };
-
-    void sendActiveSense() override {
-        uint8_t cmd = ActiveSense;
-        sendRawMIDIBuffer (&cmd, 1);
-    };
-
-    void sendReset() override {
-        uint8_t cmd = MIDIReset;
-        sendRawMIDIBuffer (&cmd, 1);
-    };
-
-    void sendRawMIDIBuffer (uint8_t *bytesToSend, int length) override {
+protected:
+    void writeRawMIDIBytes (const uint8_t *bytesToWrite, int length) override {
         //Initialize Packetlist
         pktList = (MIDIPacketList *) &buffer;
         pkt = MIDIPacketListInit (pktList);
         //Add bytes to send to list
-        pkt = MIDIPacketListAdd (pktList, 1024, pkt, 0, length, bytesToSend);
+        pkt = MIDIPacketListAdd (pktList, 1024, pkt, 0, length, bytesToWrite);
         //Send list
         MIDISend (outputPort, destination, pktList);
     };
 
-protected:
     // Everything describing the "physical" MIDI device
     MIDIEntityRef entity;
     MIDIClientRef client;
@@ -344,8 +115,6 @@ protected:
     MIDIPacketList *pktList;
     MIDIPacket *pkt;
 
-    std::vector<char> sysExReceiveBuffer;
-
     static void readProc (const MIDIPacketList *newPackets, void *refCon, void *connRefCon) {
 
         // The connRefCon pointer is the pointer was handed to the MIDIPortConnectSource function call when setting up the connection.
@@ -356,124 +125,21 @@ protected:
         MIDIPacket *packet = (MIDIPacket *) newPackets->packet;
         int packetCount = newPackets->numPackets;
         for (int k = 0; k < packetCount; k++) {
-            const uint8_t messageHeader = packet->data[0];
-
-            // Process a SysEx if there is a SysExBegin header or if the sysExReceiveBuffer is still filled with unterminated data from the previous packet.
-            if ((messageHeader == (uint8_t)SysExBegin) || (!callbackDestination->sysExReceiveBuffer.empty ())) {
-                uint16_t currentPacketLength = packet->length;
-
-                for (uint16_t i = 0; i < currentPacketLength; i++) {
-                    callbackDestination->sysExReceiveBuffer.push_back ((char)packet->data[i]);
+            // A time stamp of 0 means the packet was meant to be delivered immediately, so it carries no receive time
+            if (packet->timeStamp != 0)
+                callbackDestination->receiveTimestamp = MIDITimestamp::fromMachAbsoluteTime (packet->timeStamp);
+            else
+                callbackDestination->receiveTimestamp = MIDITimestamp::now();
 
-                    if (packet->data[i] == (uint8_t)SysExEnd) {
-                        callbackDestination->receivedSysEx (callbackDestination->sysExReceiveBuffer.data (), callbackDestination->sysExReceiveBuffer.size ());
-
-                        // clear the sysExReceiveBuffer so that sysExReceiveBuffer.empty() will return true
-                        callbackDestination->sysExReceiveBuffer.clear ();
-                        // stop the for loop
-                        i = currentPacketLength;
-                    }
-                }
-            } else {
-                // process 8 Bit Commands
-                switch (messageHeader) {
-                    case MIDITimecodeQuarterFrame:
-                        callbackDestination->receivedMIDITimecodeQuarterFrame (packet->data[1]);
-                        break;
-
-                    case SongPositionPointerCmd: {
-                        // take the msb and shift it up
-                        uint16_t positionInBeats = packet->data[2];
-                        positionInBeats <<= 7;
-                        // add the lsb
-                        positionInBeats &= packet->data[1];
-                        callbackDestination->receivedSongPositionPointer (positionInBeats);
-                    }
-                        break;
-
-                    case SongSelectCmd:
-                        callbackDestination->receivedSongSelect (packet->data[1]);
-                        break;
-
-                    case TuneRequest:
-                        callbackDestination->receivedTuneRequest();
-                        break;
-
-                    case ClockTickCmd:
-                        callbackDestination->receivedMIDIClockTick ();
-                        break;
-
-                    case StartCmd:
-                        callbackDestination->receivedMIDIStart ();
-                        break;
-
-                    case StopCmd:
-                        callbackDestination->receivedMIDIStop ();
-                        break;
-
-                    case ContinueCmd:
-                        callbackDestination->receivedMIDIContinue ();
-                        break;
-
-                    case ActiveSense:
-                        callbackDestination->receivedActiveSense();
-                        break;
-
-                    case MIDIReset:
-                        callbackDestination->receivedMIDIReset();
-                        break;
-
-                    default: {
-                        // process 4 Bit commands with channel
-                        uint8_t midiChannel = messageHeader & 0x0F;
-                        uint8_t midiCommand = messageHeader >> 4;
-
-
-
-                        if ((callbackDestination->receiveChannel == midiChannel) || (callbackDestination->receiveChannel == ChannelAny)) {
-
-                            callbackDestination->lastChannel = (Channel)midiChannel;
-
-                            switch (midiCommand) {
-                                case NoteOnCmd:
-                                    callbackDestination->receivedNote (packet->data[1], packet->data[2], NoteOn);
-                                    break;
-
-                                case NoteOffCmd:
-                                    callbackDestination->receivedNote (packet->data[1], packet->data[2], NoteOff);
-                                    break;
-
-                                case PolyphonicAftertouchCmd:
-                                    callbackDestination->receivedAftertouch (packet->data[1], packet->data[2]);
-                                    break;
-
-                                case MonophonicAftertouchCmd:
-                                    callbackDestination->receivedAftertouch (MonophonicAftertouch, packet->data[1]);
-
-                                case ControlChangeCmd:
-                                    callbackDestination->receivedControlChange (packet->data[1], packet->data[2]);
-                                    break;
-
-                                case ProgrammChangeCmd:
-                                    callbackDestination->receivedProgramChange (packet->data[1]);
-                                    break;
-
-                                case PitchBendCmd:
-                                    callbackDestination->receivedPitchBend (packet->data[1]);
-                                    break;
-
-                                default:
-                                    callbackDestination->receivedUnknownCommand (packet->data, packet->length);
-                                    break;
-                            }
-                        }
-                    }
-                        break;
-                }
-            }
+            // A packet may contain several messages or only a part of a SysEx, the parser takes care of both
+            callbackDestination->receiveParser.feed (*callbackDestination, packet->data, packet->length);
 
             packet = MIDIPacketNext (packet);
         }
+
+        // There is no thread of our own that could wait for the LSB of a combined message, so MSBs that waited too
+        // long are passed on when the next packet arrives
+        callbackDestination->expireParameterAssembly();
     }
 
 };
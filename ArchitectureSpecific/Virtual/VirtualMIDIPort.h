@@ -0,0 +1,369 @@
+//
+//  VirtualMIDIPort.h
+//
+//  In-process MIDI connection without any hardware, for tests and benchmarks
+//
+
+#ifndef VirtualMIDIPort_h
+#define VirtualMIDIPort_h
+
+#include "../../simpleMIDI.h"
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#ifdef SIMPLE_MIDI_TTY
+#include "../Linux/MIDIEventLoop.h"
+#include <unistd.h>
+#include <sys/eventfd.h>
+#endif
+
+// Number of bytes that can be in flight on each connection between two virtual ports, must be a power of two
+#ifndef SIMPLE_MIDI_VIRTUAL_PORT_BUFFER_SIZE
+#define SIMPLE_MIDI_VIRTUAL_PORT_BUFFER_SIZE 4096
+#endif
+
+
+/**
+ * A SimpleMIDI connection that lives completely in memory. Everything sent on a port is received by all ports it
+ * is connected to, parsed and dispatched to their receivedXYZ() callbacks like bytes from a real device, so
+ * handlers can be tested and benchmarked without any hardware. Any number of ports can be connected to any number
+ * of others, a port may even be connected to itself.
+ *
+ * Each connection has its own parser, so running status and SysEx messages of different senders don't get mixed
+ * up. The receiving port decides how bytes are delivered:
+ * - Synchronous: the callbacks are invoked by the thread that sends, before the send function returns. Several
+ *   senders are serialized by a mutex. Don't build cycles of synchronous ports, they would recurse forever
+ * - ReaderThread: each connection carries the bytes through a lock free ring buffer to a reader thread of the
+ *   receiving port, which sleeps until bytes arrive, like the receive thread of a real device. A sender waits
+ *   if the ring buffer is full, so nothing is lost
+ * - EventLoop (Linux only): like ReaderThread, but the bytes are received by the thread of a MIDIEventLoop that
+ *   serves many ports
+ *
+ * The receivedXYZ() callbacks may send, e.g. to forward everything to other ports. A callback can't wait for a
+ * full ring buffer though, the thread that would drain it might be waiting for the callback's own port. Bytes that
+ * a callback sends to a full ring buffer are therefore dropped and counted by the receiving port, make the buffer
+ * size large enough for the bursts your callbacks forward. Don't connect or disconnect ports from within a
+ * receivedXYZ() callback.
+ */
+class VirtualMIDIPort : public SimpleMIDI
+#ifdef SIMPLE_MIDI_TTY
+                      , private MIDIEventLoop::Handler
+#endif
+{
+
+public:
+
+    enum Delivery : uint8_t {
+        Synchronous,
+        ReaderThread,
+#ifdef SIMPLE_MIDI_TTY
+        EventLoop
+#endif
+    };
+
+    /** Creates a port that receives synchronously or through a reader thread of its own */
+    VirtualMIDIPort (Delivery deliveryToUse = ReaderThread) : delivery (deliveryToUse == Synchronous ? Synchronous : ReaderThread) {
+        if (delivery == ReaderThread)
+            receiveThread = std::thread (&VirtualMIDIPort::receiveThreadWork, this);
+    }
+
+#ifdef SIMPLE_MIDI_TTY
+    /** Creates a port that receives through the event loop passed, all its callbacks are invoked from its thread */
+    VirtualMIDIPort (MIDIEventLoop &eventLoopToUse) : delivery (EventLoop) {
+        wakeUpFileDescriptor = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (eventLoopToUse.add (wakeUpFileDescriptor, *this))
+            eventLoop = &eventLoopToUse;
+    }
+#endif
+
+    ~VirtualMIDIPort() override {
+        // the thinning and send threads need the connections until everything queued was written
+        setOutputThinning (false);
+        setThreadSafeSending (false);
+
+        while (true) {
+            VirtualMIDIPort *source = nullptr;
+            VirtualMIDIPort *destination = nullptr;
+            {
+                std::lock_guard<std::mutex> lock (outgoingMutex);
+                if (!outgoingConnections.empty())
+                    destination = outgoingConnections.back()->destination;
+            }
+            if (destination == nullptr) {
+                std::lock_guard<std::mutex> lock (incomingMutex);
+                if (!incomingConnections.empty())
+                    source = incomingConnections.back()->source;
+            }
+
+            if (destination != nullptr)
+                disconnectFrom (*destination);
+            else if (source != nullptr)
+                source->disconnectFrom (*this);
+            else
+                break;
+        }
+
+        if (receiveThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock (receiveThreadMutex);
+                receiveThreadShouldExit = true;
+            }
+            receiveThreadWakeUp.notify_one();
+            receiveThread.join();
+        }
+
+#ifdef SIMPLE_MIDI_TTY
+        if (eventLoop != nullptr)
+            eventLoop->remove (wakeUpFileDescriptor);
+        if (wakeUpFileDescriptor >= 0)
+            close (wakeUpFileDescriptor);
+#endif
+    }
+
+    /**
+     * Sends everything sent on this port to the destination port as well.
+     * @return  false if the ports are connected already
+     */
+    bool connectTo (VirtualMIDIPort &destination) {
+        std::lock (outgoingMutex, destination.incomingMutex);
+        std::lock_guard<std::mutex> outgoingLock (outgoingMutex, std::adopt_lock);
+        std::lock_guard<std::mutex> incomingLock (destination.incomingMutex, std::adopt_lock);
+
+        bool connected = findConnection (destination) != outgoingConnections.end();
+        if (!connected) {
+            Connection *connection = new Connection;
+            connection->source = this;
+            connection->destination = &destination;
+            outgoingConnections.push_back (connection);
+            destination.incomingConnections.push_back (connection);
+        }
+
+        return !connected;
+    }
+
+    /**
+     * Removes the connection to the destination port. Bytes that were not received by the destination yet are lost.
+     * @return  false if the ports were not connected
+     */
+    bool disconnectFrom (VirtualMIDIPort &destination) {
+        Connection *connection = nullptr;
+        {
+            std::lock (outgoingMutex, destination.incomingMutex);
+            std::lock_guard<std::mutex> outgoingLock (outgoingMutex, std::adopt_lock);
+            std::lock_guard<std::mutex> incomingLock (destination.incomingMutex, std::adopt_lock);
+
+            std::vector<Connection *>::iterator outgoing = findConnection (destination);
+            if (outgoing != outgoingConnections.end()) {
+                connection = *outgoing;
+                outgoingConnections.erase (outgoing);
+                destination.incomingConnections.erase (std::find (destination.incomingConnections.begin(), destination.incomingConnections.end(), connection));
+            }
+        }
+
+        delete connection;
+        return connection != nullptr;
+    }
+
+    size_t getNumOutgoingConnections() {
+        std::lock_guard<std::mutex> lock (outgoingMutex);
+        return outgoingConnections.size();
+    }
+
+    size_t getNumIncomingConnections() {
+        std::lock_guard<std::mutex> lock (incomingMutex);
+        return incomingConnections.size();
+    }
+
+    /** Number of bytes that callbacks sent to this port while its ring buffer was full, @see VirtualMIDIPort */
+    uint64_t getNumBytesDropped() const {
+        return numBytesDropped.load (std::memory_order_relaxed);
+    }
+
+protected:
+
+    void writeRawMIDIBytes (const uint8_t *bytesToWrite, int length) override {
+        std::lock_guard<std::mutex> lock (outgoingMutex);
+
+        for (size_t i = 0; i < outgoingConnections.size(); i++) {
+            Connection &connection = *outgoingConnections[i];
+            VirtualMIDIPort &destination = *connection.destination;
+
+            if (destination.delivery == Synchronous) {
+                std::lock_guard<std::mutex> deliveryLock (destination.synchronousDeliveryMutex);
+                const bool wasDelivering = isDeliveringThread();
+                isDeliveringThread() = true;
+                destination.receiveTimestamp = MIDITimestamp::now();
+                connection.parser.feed (destination, bytesToWrite, length);
+                isDeliveringThread() = wasDelivering;
+                continue;
+            }
+
+            // Either all bytes fit or none are pushed, so the parser of the connection never sees a cut message
+            if (isDeliveringThread()) {
+                if (connection.bytes.getCapacity() - connection.bytes.size() >= (uint32_t)length)
+                    connection.bytes.push (bytesToWrite, length);
+                else
+                    destination.numBytesDropped.fetch_add (length, std::memory_order_relaxed);
+                destination.wakeUpReceiveThread();
+                continue;
+            }
+
+            size_t numBytesPushed = 0;
+            while (true) {
+                numBytesPushed += connection.bytes.push (bytesToWrite + numBytesPushed, length - numBytesPushed);
+                if (numBytesPushed == (size_t)length)
+                    break;
+                destination.wakeUpReceiveThread();
+                std::this_thread::yield();
+            }
+            destination.wakeUpReceiveThread();
+        }
+    }
+
+private:
+
+    struct Connection : public CacheLineAligned {
+        VirtualMIDIPort *source;
+        VirtualMIDIPort *destination;
+        MIDIParser<SimpleMIDI> parser;
+        SPSCQueue<uint8_t, SIMPLE_MIDI_VIRTUAL_PORT_BUFFER_SIZE> bytes;
+    };
+
+    const Delivery delivery;
+
+    // The sender holds outgoingMutex while it writes, the receiving side holds incomingMutex while it drains the
+    // connections. A callback can therefore send on the port that is delivering to it
+    std::mutex outgoingMutex;
+    std::vector<Connection *> outgoingConnections;
+    std::mutex incomingMutex;
+    std::vector<Connection *> incomingConnections;
+    std::atomic<uint64_t> numBytesDropped {0};
+
+    std::mutex synchronousDeliveryMutex;
+
+    std::thread receiveThread;
+    std::mutex receiveThreadMutex;
+    std::condition_variable receiveThreadWakeUp;
+    std::atomic<bool> receiveThreadSleeping {false};
+    std::atomic<bool> newBytesAvailable {false};
+    bool receiveThreadShouldExit = false;
+
+    static const int receiveBufferSize = 1024;
+
+#ifdef SIMPLE_MIDI_TTY
+    MIDIEventLoop *eventLoop = nullptr;
+    int wakeUpFileDescriptor = -1;
+    std::atomic<bool> wakeUpPending {false};
+
+    bool fileDescriptorReadable() override {
+        uint64_t unused;
+        ssize_t result = read (wakeUpFileDescriptor, &unused, sizeof (unused));
+        (void)result;
+
+        // bytes pushed after this are either seen by the drain below or signal the loop again
+        wakeUpPending.store (false, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        drainIncomingConnections();
+        expireParameterAssembly();
+        return true;
+    }
+
+    int getTimeout() override {
+        return getParameterAssemblyTimeout();
+    }
+
+    void timeoutExpired() override {
+        expireParameterAssembly();
+    }
+#endif
+
+    std::vector<Connection *>::iterator findConnection (VirtualMIDIPort &destination) {
+        std::vector<Connection *>::iterator it = outgoingConnections.begin();
+        while ((it != outgoingConnections.end()) && ((*it)->destination != &destination))
+            ++it;
+        return it;
+    }
+
+    /** True while the calling thread delivers bytes to the callbacks of any port */
+    static bool &isDeliveringThread() {
+        static thread_local bool isDelivering = false;
+        return isDelivering;
+    }
+
+    void wakeUpReceiveThread() {
+#ifdef SIMPLE_MIDI_TTY
+        if (delivery == EventLoop) {
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            if (!wakeUpPending.exchange (true)) {
+                const uint64_t signal = 1;
+                ssize_t unused = write (wakeUpFileDescriptor, &signal, sizeof (signal));
+                (void)unused;
+            }
+            return;
+        }
+#endif
+
+        // Same protocol as the send thread of SimpleMIDI: the fences make sure that either the receive thread sees
+        // the new bytes before it goes to sleep or this thread sees it sleeping
+        newBytesAvailable.store (true, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        if (receiveThreadSleeping.load (std::memory_order_relaxed) && receiveThreadSleeping.exchange (false)) {
+            std::lock_guard<std::mutex> lock (receiveThreadMutex);
+            receiveThreadWakeUp.notify_one();
+        }
+    }
+
+    void drainIncomingConnections() {
+        uint8_t receiveBuffer[receiveBufferSize];
+
+        std::lock_guard<std::mutex> lock (incomingMutex);
+        const bool wasDelivering = isDeliveringThread();
+        isDeliveringThread() = true;
+        for (size_t i = 0; i < incomingConnections.size(); i++) {
+            Connection &connection = *incomingConnections[i];
+            while (size_t numBytes = connection.bytes.pop (receiveBuffer, receiveBufferSize)) {
+                receiveTimestamp = MIDITimestamp::now();
+                connection.parser.feed (*this, receiveBuffer, numBytes);
+            }
+        }
+        isDeliveringThread() = wasDelivering;
+    }
+
+    void receiveThreadWork() {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::Receive);
+        while (true) {
+            newBytesAvailable.store (false, std::memory_order_relaxed);
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+
+            drainIncomingConnections();
+
+            std::unique_lock<std::mutex> lock (receiveThreadMutex);
+            receiveThreadSleeping.store (true, std::memory_order_relaxed);
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+
+            if (!newBytesAvailable.load (std::memory_order_relaxed)) {
+                if (receiveThreadShouldExit)
+                    break;
+
+                // combined messages whose LSB didn't arrive in time are passed on when the wait times out
+                const int timeout = getParameterAssemblyTimeout();
+                if (timeout < 0)
+                    receiveThreadWakeUp.wait (lock);
+                else
+                    receiveThreadWakeUp.wait_for (lock, std::chrono::milliseconds (timeout));
+            }
+            receiveThreadSleeping.store (false, std::memory_order_relaxed);
+            lock.unlock();
+
+            expireParameterAssembly();
+        }
+    }
+};
+
+#endif /* VirtualMIDIPort_h */
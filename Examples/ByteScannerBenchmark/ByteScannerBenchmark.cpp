@@ -0,0 +1,100 @@
+//
+//  ByteScannerBenchmark.cpp
+//
+//  Compares the vector kernels of MIDIByteScanner to the scalar byte loop on large SysEx dumps.
+//  Build with: g++ -std=c++11 -O2 -I../.. ByteScannerBenchmark.cpp -pthread
+//
+
+#include "simpleMIDI.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+static const char *kernelNames[] = {"scalar", "SSE2", "AVX2", "NEON"};
+
+/** A SysEx dump of the size passed: start byte, pseudo random data bytes and the end byte */
+static std::vector<uint8_t> makeSysExDump (size_t numBytes) {
+    std::vector<uint8_t> dump (numBytes);
+    uint32_t random = 1;
+    for (size_t i = 0; i < numBytes; i++) {
+        random = random * 1664525 + 1013904223;
+        dump[i] = (random >> 24) & 0b01111111;
+    }
+    dump.front() = 0xF0;
+    dump.back() = 0xF7;
+    return dump;
+}
+
+/** Checks every kernel against the scalar loop on short buffers with the status byte at all positions */
+static bool kernelsAgree (MIDIByteScanner::Kernel kernel) {
+    MIDIByteScanner::selectKernel (kernel);
+    std::vector<uint8_t> buffer (100);
+    for (size_t length = 0; length < buffer.size(); length++) {
+        for (size_t position = 0; position <= length; position++) {
+            std::fill (buffer.begin(), buffer.end(), 0x55);
+            if (position < length)
+                buffer[position] = 0x80 | (uint8_t)position;
+
+            const uint8_t *expected = MIDIByteScanner::findStatusByteScalar (buffer.data(), buffer.data() + length);
+            if (MIDIByteScanner::findStatusByte (buffer.data(), buffer.data() + length) != expected)
+                return false;
+        }
+    }
+    return true;
+}
+
+/** Returns the throughput in bytes per second of scanning the dump for its end, without the start byte */
+static double measure (MIDIByteScanner::Kernel kernel, const std::vector<uint8_t> &dump, int numRepetitions) {
+    MIDIByteScanner::selectKernel (kernel);
+    const uint8_t *begin = dump.data() + 1;
+    const uint8_t *end = dump.data() + dump.size();
+
+    // warm up the caches and the page tables
+    const uint8_t *found = MIDIByteScanner::findStatusByte (begin, end);
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numRepetitions; i++)
+        found = MIDIByteScanner::findStatusByte (begin, end);
+    const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+
+    if (found != end - 1) {
+        printf ("%s kernel missed the end of the dump\n", kernelNames[kernel]);
+        exit (1);
+    }
+    return (double)(end - begin) * numRepetitions / seconds;
+}
+
+int main() {
+    const MIDIByteScanner::Kernel automaticKernel = MIDIByteScanner::getKernel();
+    printf ("kernel picked at startup: %s\n\n", kernelNames[automaticKernel]);
+
+    bool passed = true;
+    for (int kernel = MIDIByteScanner::ScalarKernel; kernel <= MIDIByteScanner::NEONKernel; kernel++) {
+        if (MIDIByteScanner::isSupported ((MIDIByteScanner::Kernel)kernel) && !kernelsAgree ((MIDIByteScanner::Kernel)kernel)) {
+            printf ("%s kernel finds other bytes than the scalar loop\n", kernelNames[kernel]);
+            passed = false;
+        }
+    }
+
+    // from a dump that stays in the L1 cache to one that has to come from memory
+    const size_t dumpSizes[] = {4 * 1024, 256 * 1024, 64 * 1024 * 1024};
+    for (size_t size : dumpSizes) {
+        const std::vector<uint8_t> dump = makeSysExDump (size);
+        const int numRepetitions = (int)((size_t)1024 * 1024 * 1024 / size);
+
+        printf ("SysEx dump of %zu kB\n", size / 1024);
+        const double scalarThroughput = measure (MIDIByteScanner::ScalarKernel, dump, numRepetitions);
+        for (int kernel = MIDIByteScanner::ScalarKernel; kernel <= MIDIByteScanner::NEONKernel; kernel++) {
+            if (!MIDIByteScanner::isSupported ((MIDIByteScanner::Kernel)kernel))
+                continue;
+
+            const double throughput = (kernel == MIDIByteScanner::ScalarKernel) ? scalarThroughput : measure ((MIDIByteScanner::Kernel)kernel, dump, numRepetitions);
+            printf ("  %-6s %6.2f GB/s  %5.1fx scalar\n", kernelNames[kernel], throughput / 1e9, throughput / scalarThroughput);
+        }
+    }
+
+    MIDIByteScanner::selectKernel (automaticKernel);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+//
+//  DispatchBenchmark.cpp
+//
+//  Compares the virtual SimpleMIDI interface to the compile time StaticMIDI front end. Both parse the same buffer
+//  of channel messages and send the same messages, no MIDI hardware is needed.
+//  Build on Linux or macOS with: g++ -std=c++11 -O2 -I../.. DispatchBenchmark.cpp -pthread
+//
+
+#include "simpleMIDI.h"
+#include <cstdio>
+#include <vector>
+#include <chrono>
+
+static const int numMessages = 10000;
+static const int numRepetitions = 2000;
+
+/** Notes, control changes, pitch bends and clock ticks, as a sequencer or a controller keyboard would send them */
+static std::vector<uint8_t> makeStream() {
+    std::vector<uint8_t> stream;
+    for (int i = 0; i < numMessages; i++) {
+        const uint8_t value = i & 0b01111111;
+        switch (i % 5) {
+            case 0: stream.push_back (0x90); stream.push_back (value); stream.push_back (100);   break;
+            case 1: stream.push_back (0xB1); stream.push_back (7);     stream.push_back (value); break;
+            case 2: stream.push_back (0xF8);                                                     break;
+            case 3: stream.push_back (0xE0); stream.push_back (0);     stream.push_back (value); break;
+            case 4: stream.push_back (0x80); stream.push_back (value); stream.push_back (0);     break;
+        }
+    }
+    return stream;
+}
+
+/** The usual SimpleMIDI way: override the virtual callbacks and writeRawMIDIBytes() */
+class VirtualReceiver : public VirtualMIDIPort {
+public:
+    VirtualReceiver() : VirtualMIDIPort (Synchronous) {}
+
+    void feed (const std::vector<uint8_t> &stream) {
+        receiveParser.feed (*this, stream.data(), stream.size());
+    }
+
+    uint64_t checksum = 0;
+    uint64_t numBytesSent = 0;
+
+private:
+    void receivedNote (uint8_t note, uint8_t velocity, bool onOff) override { checksum += note + velocity; }
+    void receivedControlChange (uint8_t control, uint8_t value) override   { checksum += value; }
+    void receivedPitchBend (int16_t pitch) override                        { checksum += pitch; }
+    void receivedMIDIClockTick() override                                  { checksum++; }
+
+    void writeRawMIDIBytes (const uint8_t *bytesToWrite, int length) override {
+        numBytesSent += length;
+        lastByteSent = bytesToWrite[length - 1];
+    }
+
+    volatile uint8_t lastByteSent = 0;
+};
+
+/** The volatile store keeps the compiler from folding the whole send loop away once it can see through the calls */
+struct CountingTransport {
+    uint64_t numBytesSent = 0;
+    volatile uint8_t lastByteSent = 0;
+
+    void write (const uint8_t *bytes, size_t length) {
+        numBytesSent += length;
+        lastByteSent = bytes[length - 1];
+    }
+};
+
+/** The same handlers, bound at compile time */
+class StaticReceiver : public StaticMIDI<StaticReceiver, CountingTransport> {
+public:
+    StaticReceiver (CountingTransport &transport) : StaticMIDI<StaticReceiver, CountingTransport> (transport) {}
+
+    uint64_t checksum = 0;
+
+    void receivedNote (uint8_t note, uint8_t velocity, bool onOff) { checksum += note + velocity; }
+    void receivedControlChange (uint8_t control, uint8_t value)   { checksum += value; }
+    void receivedPitchBend (int16_t pitch)                        { checksum += pitch; }
+    void receivedMIDIClockTick()                                  { checksum++; }
+};
+
+template <typename Function>
+static double nanosecondsPerMessage (Function function) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numRepetitions; i++)
+        function();
+    const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+    return seconds * 1e9 / ((double)numMessages * numRepetitions);
+}
+
+int main() {
+    const std::vector<uint8_t> stream = makeStream();
+    VirtualReceiver virtualReceiver;
+    CountingTransport transport;
+    StaticReceiver staticReceiver (transport);
+
+    // the first round warms up the caches and the branch predictors
+    for (int round = 0; round < 3; round++) {
+        const double virtualReceive = nanosecondsPerMessage ([&]() { virtualReceiver.feed (stream); });
+        const double staticReceive = nanosecondsPerMessage ([&]() { staticReceiver.receive (stream.data(), stream.size(), 0); });
+
+        const double virtualSend = nanosecondsPerMessage ([&]() {
+            for (int i = 0; i < numMessages; i++)
+                virtualReceiver.sendControlChange (7, i & 0b01111111, SimpleMIDI::Channel2);
+        });
+        const double staticSend = nanosecondsPerMessage ([&]() {
+            for (int i = 0; i < numMessages; i++)
+                staticReceiver.sendControlChange (7, i & 0b01111111, SimpleMIDI::Channel2);
+        });
+
+        printf ("receive: SimpleMIDI %5.2f ns/msg, StaticMIDI %5.2f ns/msg (%.1fx)   "
+                "send: SimpleMIDI %5.2f ns/msg, StaticMIDI %5.2f ns/msg (%.1fx)\n",
+                virtualReceive, staticReceive, virtualReceive / staticReceive,
+                virtualSend, staticSend, virtualSend / staticSend);
+    }
+
+    // both front ends have to see the same messages, otherwise the comparison is meaningless
+    const bool same = (virtualReceiver.checksum == staticReceiver.checksum) && (virtualReceiver.numBytesSent == transport.numBytesSent);
+    printf ("checksums %s\n", same ? "match" : "DIFFER");
+    return same ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+//
+//  EventLoopEngineBenchmark.cpp
+//
+//  Floods pseudo terminal ports on a MIDIEventLoop with notes and compares the epoll and io_uring engines: how many
+//  messages per second the loop thread receives and how much CPU time each message costs, once only receiving and
+//  once with every note forwarded back from the callback. No MIDI hardware is needed. The epoll engine writes the
+//  echo itself and waits for each pty, the io_uring engine never waits and drops what exceeds
+//  SIMPLE_MIDI_EVENT_LOOP_MAX_STAGED_BYTES, so it receives and echoes more but reports dropped bytes.
+//  Build on Linux with: g++ -std=c++11 -O2 -I../.. EventLoopEngineBenchmark.cpp -pthread -lutil
+//
+
+#include "simpleMIDI.h"
+#include <cstdio>
+
+#ifdef SIMPLE_MIDI_TTY
+#include <pty.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <memory>
+#include <vector>
+
+static const int numPorts = 64;
+static const int secondsToRun = 2;
+
+static std::atomic<uint64_t> numNotesReceived {0};
+
+class EchoPort : public TTYMIDIWrapper {
+public:
+    EchoPort (TTYMIDIDeviceRessource &device, MIDIEventLoop &eventLoop, bool echoNotes)
+      : TTYMIDIWrapper (device, eventLoop), echo (echoNotes) {}
+
+private:
+    void receivedNote (uint8_t note, uint8_t velocity, bool onOff) override {
+        numNotesReceived.fetch_add (1, std::memory_order_relaxed);
+        if (echo)
+            sendNote (note, velocity, onOff);
+    }
+
+    const bool echo;
+};
+
+static double cpuSeconds() {
+    rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static const char *engineName (MIDIEventLoop::Engine engine) {
+    return engine == MIDIEventLoop::IOUringEngine ? "io_uring" : "epoll";
+}
+
+static bool measure (MIDIEventLoop::Engine engine, bool echo) {
+    MIDIEventLoop eventLoop (engine);
+    if (eventLoop.getEngine() != engine) {
+        printf ("%-8s not available on this kernel\n", engineName (engine));
+        return true;
+    }
+
+    std::vector<int> masters (numPorts), slaves (numPorts);
+    std::vector<std::unique_ptr<EchoPort>> ports;
+    for (int i = 0; i < numPorts; i++) {
+        char name[256];
+        if (openpty (&masters[i], &slaves[i], name, nullptr, nullptr) != 0) {
+            printf ("can't open pseudo terminal %d\n", i);
+            return false;
+        }
+        fcntl (masters[i], F_SETFL, fcntl (masters[i], F_GETFL) | O_NONBLOCK);
+        SimpleMIDI::HardwareResource device;
+        device.deviceName = name;
+        ports.emplace_back (new EchoPort (device, eventLoop, echo));
+    }
+    std::this_thread::sleep_for (std::chrono::milliseconds (50));
+    numNotesReceived = 0;
+
+    // keep every pty as full as it takes, the loop thread never runs out of work
+    uint8_t notes[96];
+    for (int i = 0; i < 32; i++) {
+        notes[i * 3] = 0x90;
+        notes[i * 3 + 1] = 60;
+        notes[i * 3 + 2] = 100;
+    }
+    uint8_t echoed[4096];
+    uint64_t numBytesEchoed = 0;
+
+    const double cpuAtStart = cpuSeconds();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds (secondsToRun)) {
+        for (int i = 0; i < numPorts; i++) {
+            if (write (masters[i], notes, sizeof (notes)) < 0 && errno != EAGAIN)
+                return false;
+            ssize_t numRead;
+            while ((numRead = read (masters[i], echoed, sizeof (echoed))) > 0)
+                numBytesEchoed += numRead;
+        }
+    }
+    const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+    const double cpuUsed = cpuSeconds() - cpuAtStart;
+    const uint64_t received = numNotesReceived.load();
+
+    printf ("%-8s %-8s %5d k msgs/s received, %5.0f ns CPU per message, %5d k msgs/s echoed, %llu bytes dropped\n",
+            engineName (engine), echo ? "echo" : "receive", (int)(received / seconds / 1000), cpuUsed * 1e9 / received,
+            (int)(numBytesEchoed / 3 / seconds / 1000), (unsigned long long)eventLoop.getNumBytesDropped());
+
+    for (int i = 0; i < numPorts; i++)
+        close (masters[i]);
+    ports.clear();
+    for (int i = 0; i < numPorts; i++)
+        close (slaves[i]);
+    return received > 0;
+}
+
+int main() {
+    bool ok = true;
+    const MIDIEventLoop::Engine engines[] = {MIDIEventLoop::EpollEngine, MIDIEventLoop::IOUringEngine};
+    for (MIDIEventLoop::Engine engine : engines) {
+        ok &= measure (engine, false);
+        ok &= measure (engine, true);
+    }
+    return ok ? 0 : 1;
+}
+
+#else
+
+int main() {
+    printf ("MIDIEventLoop is only available with the Linux tty implementation\n");
+    return 0;
+}
+
+#endif
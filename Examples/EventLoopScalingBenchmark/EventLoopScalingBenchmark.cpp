@@ -0,0 +1,109 @@
+//
+//  EventLoopScalingBenchmark.cpp
+//
+//  Measures the CPU time it takes to receive from many ports, with a receive thread per port and with all ports on
+//  one MIDIEventLoop. The ports are pseudo terminals, so no MIDI hardware is needed. Every port receives a note
+//  every 10 ms, like a room full of controllers being played.
+//  Build on Linux with: g++ -std=c++11 -O2 -I../.. EventLoopScalingBenchmark.cpp -pthread -lutil
+//
+
+#include "simpleMIDI.h"
+#include <cstdio>
+
+#ifdef SIMPLE_MIDI_TTY
+#include <pty.h>
+#include <sys/resource.h>
+#include <memory>
+#include <vector>
+
+static const int numRounds = 200;
+static const int microsecondsBetweenRounds = 10000;
+
+static std::atomic<int> numNotesReceived {0};
+
+class CountingPort : public TTYMIDIWrapper {
+public:
+    CountingPort (TTYMIDIDeviceRessource &device) : TTYMIDIWrapper (device) {}
+    CountingPort (TTYMIDIDeviceRessource &device, MIDIEventLoop &eventLoop) : TTYMIDIWrapper (device, eventLoop) {}
+
+private:
+    void receivedNote (uint8_t note, uint8_t velocity, bool onOff) override {
+        numNotesReceived++;
+    }
+};
+
+static double cpuSeconds() {
+    rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static bool measure (int numPorts, bool useEventLoop) {
+    std::vector<int> masters (numPorts), slaves (numPorts);
+    std::unique_ptr<MIDIEventLoop> eventLoop (useEventLoop ? new MIDIEventLoop : nullptr);
+    std::vector<std::unique_ptr<CountingPort>> ports;
+
+    for (int i = 0; i < numPorts; i++) {
+        char name[256];
+        if (openpty (&masters[i], &slaves[i], name, nullptr, nullptr) != 0) {
+            printf ("can't open pseudo terminal %d, raise the limit of open files\n", i);
+            return false;
+        }
+        SimpleMIDI::HardwareResource device;
+        device.deviceName = name;
+        ports.emplace_back (useEventLoop ? new CountingPort (device, *eventLoop) : new CountingPort (device));
+    }
+    std::this_thread::sleep_for (std::chrono::milliseconds (100));
+    numNotesReceived = 0;
+
+    const uint8_t note[3] = {0x90, 60, 100};
+    const double cpuAtStart = cpuSeconds();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int round = 0; round < numRounds; round++) {
+        for (int i = 0; i < numPorts; i++)
+            if (write (masters[i], note, sizeof (note)) != sizeof (note))
+                return false;
+        std::this_thread::sleep_for (std::chrono::microseconds (microsecondsBetweenRounds));
+    }
+    std::this_thread::sleep_for (std::chrono::milliseconds (50));
+    const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+    const double cpuUsed = cpuSeconds() - cpuAtStart;
+
+    const bool allArrived = numNotesReceived.load() == numPorts * numRounds;
+    printf ("%4d ports, %-16s %5.1f%% of one core, received %d of %d notes: %s\n", numPorts,
+            useEventLoop ? "one event loop" : "thread per port", 100 * cpuUsed / seconds, numNotesReceived.load(),
+            numPorts * numRounds, allArrived ? "ok" : "FAILED");
+
+    ports.clear();
+    eventLoop.reset();
+    for (int i = 0; i < numPorts; i++) {
+        close (masters[i]);
+        close (slaves[i]);
+    }
+    return allArrived;
+}
+
+int main() {
+    // each port needs two file descriptors for its pseudo terminal and one of its own
+    rlimit limit;
+    getrlimit (RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit (RLIMIT_NOFILE, &limit);
+
+    bool ok = true;
+    const int portCounts[] = {16, 64, 256, 512};
+    for (int numPorts : portCounts) {
+        ok &= measure (numPorts, false);
+        ok &= measure (numPorts, true);
+    }
+    return ok ? 0 : 1;
+}
+
+#else
+
+int main() {
+    printf ("MIDIEventLoop is only available with the Linux tty implementation\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,116 @@
+//
+//  SendQueueBenchmark.cpp
+//
+//  Measures thread safe sending with 1, 4, 8 and 16 threads sending at the same time, through the lock free send
+//  queue and, for comparison, through one mutex around every send call. Checks that no message is lost or torn apart
+//  and that the messages of each thread arrive in order.
+//  Build on Linux or macOS with: g++ -std=c++11 -O2 -I../.. SendQueueBenchmark.cpp -pthread
+//
+
+#include "simpleMIDI.h"
+#include <cstdio>
+#include <vector>
+#include <chrono>
+
+static const int numMessages = 1 << 20;
+static const int sysExLength = 40;
+
+/** Captures everything that would go to the device instead of writing it */
+class CapturePort : public VirtualMIDIPort {
+public:
+    CapturePort() : VirtualMIDIPort (Synchronous) {
+        bytesWritten.reserve (numMessages * 3 + numMessages / 8);
+    }
+
+    std::vector<uint8_t> bytesWritten;
+    size_t numWrites = 0;
+
+private:
+    void writeRawMIDIBytes (const uint8_t *bytesToWrite, int length) override {
+        bytesWritten.insert (bytesWritten.end(), bytesToWrite, bytesToWrite + length);
+        numWrites++;
+    }
+};
+
+/** Each thread sends control changes numbered by itself and now and then a SysEx filled with its own index */
+static void sendFromThread (CapturePort &port, std::mutex *mutex, int threadIndex, int numToSend) {
+    uint8_t sysEx[sysExLength];
+    sysEx[0] = 0xF0;
+    memset (sysEx + 1, threadIndex, sysExLength - 2);
+    sysEx[sysExLength - 1] = 0xF7;
+
+    for (int i = 0; i < numToSend; i++) {
+        if (mutex != nullptr)
+            mutex->lock();
+
+        port.sendControlChange (threadIndex, i & 0b01111111, SimpleMIDI::Channel1);
+        if ((i & 1023) == 0)
+            port.sendSysEx ((char *)sysEx, sysExLength);
+
+        if (mutex != nullptr)
+            mutex->unlock();
+    }
+}
+
+static bool allMessagesInOrder (const std::vector<uint8_t> &bytes, int numThreads, int numPerThread) {
+    std::vector<int> nextValue (numThreads, 0);
+    size_t i = 0;
+    while (i < bytes.size()) {
+        if (bytes[i] == 0xF0) {
+            if (i + sysExLength > bytes.size() || bytes[i + sysExLength - 1] != 0xF7)
+                return false;
+            for (int k = 2; k < sysExLength - 1; k++)
+                if (bytes[i + k] != bytes[i + 1])
+                    return false;
+            i += sysExLength;
+            continue;
+        }
+
+        const int thread = bytes[i + 1];
+        if ((bytes[i] != 0xB0) || (thread >= numThreads) || (bytes[i + 2] != (nextValue[thread] & 0b01111111)))
+            return false;
+        nextValue[thread]++;
+        i += 3;
+    }
+
+    for (int thread = 0; thread < numThreads; thread++)
+        if (nextValue[thread] != numPerThread)
+            return false;
+    return true;
+}
+
+static bool measure (int numThreads, bool useQueue) {
+    CapturePort port;
+    std::mutex mutex;
+    if (useQueue)
+        port.setThreadSafeSending (true);
+
+    const int numPerThread = numMessages / numThreads;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++)
+        threads.emplace_back (sendFromThread, std::ref (port), useQueue ? nullptr : &mutex, t, numPerThread);
+    for (auto &thread : threads)
+        thread.join();
+
+    // disabling sends everything still queued, so the time includes draining the queue
+    if (useQueue)
+        port.setThreadSafeSending (false);
+    const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+
+    const bool ok = allMessagesInOrder (port.bytesWritten, numThreads, numPerThread);
+    printf ("%2d threads, %-10s %6.2f M msgs/s, %8zu writes: %s\n", numThreads, useQueue ? "send queue" : "mutex",
+            numPerThread * numThreads / seconds / 1e6, port.numWrites, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+    const int threadCounts[] = {1, 4, 8, 16};
+    for (int numThreads : threadCounts) {
+        ok &= measure (numThreads, true);
+        ok &= measure (numThreads, false);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+//
+//  VirtualMIDIThru.cpp
+//
+//  Forwards notes from within receive callbacks between virtual ports and checks that all of them arrive.
+//  Build on Linux with: g++ -std=c++11 -I../.. VirtualMIDIThru.cpp -pthread
+//
+
+#include "simpleMIDI.h"
+#include <cstdio>
+#include <cstdlib>
+
+static const int numNotes = 20480;
+
+/** Forwards every note it receives on itself, like the MIDI thru port of a device */
+class ThruPort : public VirtualMIDIPort {
+public:
+    ThruPort (Delivery deliveryToUse) : VirtualMIDIPort (deliveryToUse) {}
+#ifdef SIMPLE_MIDI_TTY
+    ThruPort (MIDIEventLoop &eventLoop) : VirtualMIDIPort (eventLoop) {}
+#endif
+
+private:
+    void receivedNote (uint8_t note, uint8_t velocity, bool onOff) override {
+        sendNote (note, velocity, onOff);
+    }
+};
+
+class CountingPort : public VirtualMIDIPort {
+public:
+    CountingPort (Delivery deliveryToUse) : VirtualMIDIPort (deliveryToUse) {}
+    std::atomic<int> numNotesReceived {0};
+
+private:
+    void receivedNote (uint8_t note, uint8_t velocity, bool onOff) override {
+        numNotesReceived++;
+    }
+};
+
+static bool waitForNotes (CountingPort &port, int expected) {
+    for (int i = 0; i < 5000; i++) {
+        if (port.numNotesReceived.load() >= expected)
+            break;
+        std::this_thread::sleep_for (std::chrono::milliseconds (1));
+    }
+    return port.numNotesReceived.load() == expected;
+}
+
+static bool forwardThrough (ThruPort &thru, const char *name) {
+    VirtualMIDIPort source (VirtualMIDIPort::Synchronous);
+    CountingPort sink (VirtualMIDIPort::ReaderThread);
+    source.connectTo (thru);
+    thru.connectTo (sink);
+
+    // bursts that fit into the ring buffers, so no note may be dropped or get stuck
+    const int notesPerBurst = 256;
+    bool allArrived = true;
+    for (int sent = 0; (sent < numNotes) && allArrived; sent += notesPerBurst) {
+        for (int i = 0; i < notesPerBurst; i++)
+            source.sendNote (i % 128, 100, SimpleMIDI::NoteOn);
+        allArrived = waitForNotes (sink, sent + notesPerBurst);
+    }
+    allArrived &= sink.getNumBytesDropped() == 0;
+
+    printf ("%-24s received %d notes, %llu bytes dropped: %s\n", name, sink.numNotesReceived.load(),
+            (unsigned long long)sink.getNumBytesDropped(), allArrived ? "ok" : "FAILED");
+    thru.disconnectFrom (sink);
+    return allArrived;
+}
+
+static bool sendToItself() {
+    // the ring of the connection to itself fills up, the sender has to wait for the reader thread of the same port
+    CountingPort loopback (VirtualMIDIPort::ReaderThread);
+    loopback.connectTo (loopback);
+
+    for (int i = 0; i < numNotes; i++)
+        loopback.sendNote (i % 128, 100, SimpleMIDI::NoteOn);
+
+    const bool allArrived = waitForNotes (loopback, numNotes);
+    printf ("%-24s received %d of %d notes: %s\n", "connected to itself", loopback.numNotesReceived.load(), numNotes, allArrived ? "ok" : "FAILED");
+    return allArrived;
+}
+
+int main() {
+    // a deadlock would hang the destructors, so a watchdog ends the test
+    std::thread watchdog ([]() {
+        std::this_thread::sleep_for (std::chrono::seconds (30));
+        printf ("timed out, the ports are deadlocked\n");
+        fflush (stdout);
+        std::_Exit (1);
+    });
+    watchdog.detach();
+
+    bool passed = true;
+    {
+        ThruPort thru (VirtualMIDIPort::ReaderThread);
+        passed &= forwardThrough (thru, "reader thread thru");
+    }
+#ifdef SIMPLE_MIDI_TTY
+    {
+        MIDIEventLoop eventLoop;
+        ThruPort thru (eventLoop);
+        passed &= forwardThrough (thru, "event loop thru");
+    }
+#endif
+    passed &= sendToItself();
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+//
+//  VirtualPortBenchmark.cpp
+//
+//  Measures how many messages per second a VirtualMIDIPort delivers and how long a single message takes from the
+//  send call to the receive callback, for Synchronous and ReaderThread delivery.
+//  Build on Linux or macOS with: g++ -std=c++11 -O2 -I../.. VirtualPortBenchmark.cpp -pthread
+//
+
+#include "simpleMIDI.h"
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+static const int numThroughputMessages = 2000000;
+static const int numLatencyMessages = 20000;
+
+class MeasuringPort : public VirtualMIDIPort {
+public:
+    MeasuringPort (Delivery deliveryToUse) : VirtualMIDIPort (deliveryToUse) {
+        latencies.reserve (numLatencyMessages);
+    }
+
+    std::atomic<int> numReceived {0};
+    std::atomic<uint64_t> sendTime {0};
+    std::vector<uint64_t> latencies;
+
+private:
+    void receivedControlChange (uint8_t control, uint8_t value) override {
+        numReceived.fetch_add (1, std::memory_order_release);
+    }
+
+    void receivedNote (uint8_t note, uint8_t velocity, bool onOff) override {
+        latencies.push_back (MIDITimestamp::now() - sendTime.load (std::memory_order_relaxed));
+        numReceived.fetch_add (1, std::memory_order_release);
+    }
+};
+
+static bool waitForMessages (MeasuringPort &port, int expected) {
+    for (int i = 0; i < 5000; i++) {
+        if (port.numReceived.load (std::memory_order_acquire) >= expected)
+            break;
+        std::this_thread::sleep_for (std::chrono::milliseconds (1));
+    }
+    return port.numReceived.load (std::memory_order_acquire) == expected;
+}
+
+/** Sends as fast as possible, the time runs until the last message has been received */
+static bool measureThroughput (VirtualMIDIPort::Delivery delivery, const char *name) {
+    VirtualMIDIPort source (VirtualMIDIPort::Synchronous);
+    MeasuringPort destination (delivery);
+    source.connectTo (destination);
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numThroughputMessages; i++)
+        source.sendControlChange (7, i & 0b01111111);
+    const bool allArrived = waitForMessages (destination, numThroughputMessages);
+    const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+
+    printf ("%-12s throughput %6.2f M msgs/s: %s\n", name, numThroughputMessages / seconds / 1e6, allArrived ? "ok" : "FAILED");
+    source.disconnectFrom (destination);
+    return allArrived;
+}
+
+/** Sends one message at a time and waits until it has been received before sending the next */
+static bool measureLatency (VirtualMIDIPort::Delivery delivery, const char *name) {
+    VirtualMIDIPort source (VirtualMIDIPort::Synchronous);
+    MeasuringPort destination (delivery);
+    source.connectTo (destination);
+
+    bool allArrived = true;
+    for (int i = 0; (i < numLatencyMessages) && allArrived; i++) {
+        destination.sendTime.store (MIDITimestamp::now(), std::memory_order_relaxed);
+        source.sendNote (60, 100, SimpleMIDI::NoteOn);
+        allArrived = waitForMessages (destination, i + 1);
+    }
+    source.disconnectFrom (destination);
+
+    std::vector<uint64_t> &latencies = destination.latencies;
+    std::sort (latencies.begin(), latencies.end());
+    printf ("%-12s latency median %6.2f us, 99%% %7.2f us, max %8.2f us: %s\n", name,
+            latencies[latencies.size() / 2] / 1000.0, latencies[latencies.size() * 99 / 100] / 1000.0,
+            latencies.back() / 1000.0, allArrived ? "ok" : "FAILED");
+    return allArrived;
+}
+
+int main() {
+    bool ok = true;
+    ok &= measureThroughput (VirtualMIDIPort::Synchronous, "Synchronous");
+    ok &= measureThroughput (VirtualMIDIPort::ReaderThread, "ReaderThread");
+    ok &= measureLatency (VirtualMIDIPort::Synchronous, "Synchronous");
+    ok &= measureLatency (VirtualMIDIPort::ReaderThread, "ReaderThread");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+//
+//  CacheLineAligned.h
+//
+//  Aligned heap allocation for classes with cache line aligned members
+//
+
+#ifndef CacheLineAligned_h
+#define CacheLineAligned_h
+
+#include <stddef.h>
+
+#if defined (SIMPLE_MIDI_MULTITHREADED) && !defined (__cpp_aligned_new)
+#include <stdlib.h>
+#include <new>
+#endif
+
+/**
+ * Base class for everything that contains alignas (64) members, like the lock free queues. Before C++17 the global
+ * operator new only guarantees the alignment of the largest fundamental type, so an object created with new would
+ * share its "separate" cache lines with whatever lies next to it on the heap or break the alignment the queues rely
+ * on. Deriving from this class replaces new and delete for the class and all classes derived from it with versions
+ * that allocate on a cache line boundary. Since C++17 the language does this on its own and the class is empty.
+ */
+struct CacheLineAligned {
+
+#if defined (SIMPLE_MIDI_MULTITHREADED) && !defined (__cpp_aligned_new)
+    static const size_t cacheLineSize = 64;
+
+    static void *operator new (size_t numBytes) {
+        void *memory;
+        if (posix_memalign (&memory, cacheLineSize, numBytes) != 0)
+            throw std::bad_alloc();
+        return memory;
+    }
+
+    static void operator delete (void *memory) {
+        free (memory);
+    }
+#endif
+};
+
+#endif /* CacheLineAligned_h */
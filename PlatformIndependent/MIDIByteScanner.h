@@ -0,0 +1,209 @@
+//
+//  MIDIByteScanner.h
+//
+//  Finds the next status byte in a buffer with the widest vector instructions the CPU supports
+//
+
+#ifndef MIDIByteScanner_h
+#define MIDIByteScanner_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+#include <atomic>
+#endif
+
+#if defined (__x86_64__) || defined (__i386__)
+#define SIMPLE_MIDI_SCANNER_X86
+#include <immintrin.h>
+#elif defined (__aarch64__)
+#define SIMPLE_MIDI_SCANNER_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * Searches a buffer for the next byte with the most significant bit set, which is either a status byte, a realtime
+ * byte or the end of a SysEx. Long SysEx payloads only consist of data bytes, so the parser uses this to skip them
+ * as a whole instead of looking at every single byte.
+ *
+ * The kernel is picked at runtime: AVX2 or SSE2 on x86, NEON on 64 bit ARM and a scalar byte loop everywhere else.
+ * On 8 bit microcontrollers the byte loop is the fastest solution anyway.
+ */
+class MIDIByteScanner {
+
+public:
+
+    enum Kernel : uint8_t {
+        ScalarKernel,
+        SSE2Kernel,
+        AVX2Kernel,
+        NEONKernel
+    };
+
+    /** Returns a pointer to the first byte >= 0x80 in the range from begin to end or end if there is none */
+    static const uint8_t *findStatusByte (const uint8_t *begin, const uint8_t *end) {
+        return load (selectedFunction()) (begin, end);
+    }
+
+    /**
+     * Overrides the kernel chosen at startup, e.g. to compare them against each other. May be called while receive
+     * threads are scanning, a scan that runs at the same time finishes with the kernel it started with.
+     * @return  false if the CPU doesn't support the kernel, in this case the current one is kept
+     */
+    static bool selectKernel (Kernel kernel) {
+        if (!isSupported (kernel))
+            return false;
+
+        store (selectedFunction(), functionFor (kernel));
+        store (selectedKernel(), kernel);
+        return true;
+    }
+
+    /** Returns the kernel currently in use */
+    static Kernel getKernel() {
+        // make sure the automatic selection took place
+        selectedFunction();
+        return load (selectedKernel());
+    }
+
+    static bool isSupported (Kernel kernel) {
+        switch (kernel) {
+            case ScalarKernel:
+                return true;
+#ifdef SIMPLE_MIDI_SCANNER_X86
+            case SSE2Kernel:
+                return __builtin_cpu_supports ("sse2");
+            case AVX2Kernel:
+                return __builtin_cpu_supports ("avx2");
+#endif
+#ifdef SIMPLE_MIDI_SCANNER_NEON
+            case NEONKernel:
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+    static const uint8_t *findStatusByteScalar (const uint8_t *begin, const uint8_t *end) {
+        while ((begin < end) && !(*begin & 0b10000000))
+            begin++;
+        return begin;
+    }
+
+#ifdef SIMPLE_MIDI_SCANNER_X86
+    __attribute__ ((target ("sse2")))
+    static const uint8_t *findStatusByteSSE2 (const uint8_t *begin, const uint8_t *end) {
+        // movemask collects exactly the most significant bit of each byte
+        while (end - begin >= 16) {
+            const int mask = _mm_movemask_epi8 (_mm_loadu_si128 ((const __m128i *)begin));
+            if (mask != 0)
+                return begin + __builtin_ctz ((unsigned int)mask);
+            begin += 16;
+        }
+        return findStatusByteScalar (begin, end);
+    }
+
+    __attribute__ ((target ("avx2")))
+    static const uint8_t *findStatusByteAVX2 (const uint8_t *begin, const uint8_t *end) {
+        while (end - begin >= 32) {
+            const int mask = _mm256_movemask_epi8 (_mm256_loadu_si256 ((const __m256i *)begin));
+            if (mask != 0)
+                return begin + __builtin_ctz ((unsigned int)mask);
+            begin += 32;
+        }
+        return findStatusByteSSE2 (begin, end);
+    }
+#endif
+
+#ifdef SIMPLE_MIDI_SCANNER_NEON
+    static const uint8_t *findStatusByteNEON (const uint8_t *begin, const uint8_t *end) {
+        while (end - begin >= 16) {
+            const uint8x16_t bytes = vld1q_u8 (begin);
+            if (vmaxvq_u8 (bytes) & 0b10000000) {
+                // narrow the comparison result to 4 bits per byte to locate the first match
+                const uint8x16_t isStatus = vcgeq_u8 (bytes, vdupq_n_u8 (0b10000000));
+                const uint64_t nibbles = vget_lane_u64 (vreinterpret_u64_u8 (vshrn_n_u16 (vreinterpretq_u16_u8 (isStatus), 4)), 0);
+                return begin + (__builtin_ctzll (nibbles) >> 2);
+            }
+            begin += 16;
+        }
+        return findStatusByteScalar (begin, end);
+    }
+#endif
+
+private:
+
+    typedef const uint8_t *(*ScanFunction) (const uint8_t *, const uint8_t *);
+
+    static ScanFunction functionFor (Kernel kernel) {
+        switch (kernel) {
+#ifdef SIMPLE_MIDI_SCANNER_X86
+            case SSE2Kernel:
+                return findStatusByteSSE2;
+            case AVX2Kernel:
+                return findStatusByteAVX2;
+#endif
+#ifdef SIMPLE_MIDI_SCANNER_NEON
+            case NEONKernel:
+                return findStatusByteNEON;
+#endif
+            default:
+                return findStatusByteScalar;
+        }
+    }
+
+    static Kernel bestSupportedKernel() {
+        if (isSupported (AVX2Kernel))
+            return AVX2Kernel;
+        if (isSupported (SSE2Kernel))
+            return SSE2Kernel;
+        if (isSupported (NEONKernel))
+            return NEONKernel;
+        return ScalarKernel;
+    }
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // All kernels find the same byte, so a scan may use either the old or the new one while the kernel is switched
+    // and relaxed ordering is enough
+    template <typename Value>
+    using Shared = std::atomic<Value>;
+
+    template <typename Value>
+    static Value load (const Shared<Value> &shared) {
+        return shared.load (std::memory_order_relaxed);
+    }
+
+    template <typename Value>
+    static void store (Shared<Value> &shared, Value value) {
+        shared.store (value, std::memory_order_relaxed);
+    }
+#else
+    template <typename Value>
+    using Shared = Value;
+
+    template <typename Value>
+    static Value load (const Shared<Value> &shared) {
+        return shared;
+    }
+
+    template <typename Value>
+    static void store (Shared<Value> &shared, Value value) {
+        shared = value;
+    }
+#endif
+
+    // Function local statics keep this header only. They are initialized once on the first call
+    static Shared<Kernel> &selectedKernel() {
+        static Shared<Kernel> kernel (bestSupportedKernel());
+        return kernel;
+    }
+
+    static Shared<ScanFunction> &selectedFunction() {
+        static Shared<ScanFunction> function (functionFor (load (selectedKernel())));
+        return function;
+    }
+};
+
+#endif /* MIDIByteScanner_h */
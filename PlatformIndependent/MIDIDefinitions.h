@@ -0,0 +1,133 @@
+//
+//  MIDIDefinitions.h
+//
+//  Constants and types shared by SimpleMIDI, StaticMIDI and the encoders
+//
+
+#ifndef MIDIDefinitions_h
+#define MIDIDefinitions_h
+
+#include <stdint.h>
+
+// Range checks of the send functions can be skipped on slow targets. In this case they return
+// NoErrorCheckingForSpeedReasons instead of Success
+#ifdef SIMPLE_MIDI_NO_RANGE_CHECKS
+#define SIMPLE_MIDI_CHECK_RANGE(outOfRange, errorCode)
+#define SIMPLE_MIDI_SEND_RESULT NoErrorCheckingForSpeedReasons
+#else
+#define SIMPLE_MIDI_CHECK_RANGE(outOfRange, errorCode) if (outOfRange) return errorCode;
+#define SIMPLE_MIDI_SEND_RESULT Success
+#endif
+
+class MIDIDefinitions {
+public:
+
+    static const bool NoteOn = true;
+    static const bool NoteOff = false;
+
+    //=========================================================================
+    // All possible MIDI commands, the standard describes
+    // 4 Bit commands
+    static const uint8_t NoteOffCmd =               0b1000; // 2 data Bytes
+    static const uint8_t NoteOnCmd =                0b1001; // 2 data Bytes
+    static const uint8_t PolyphonicAftertouchCmd =  0b1010; // 2 data Bytes
+    static const uint8_t ControlChangeCmd =         0b1011; // 2 data Bytes
+    static const uint8_t ProgrammChangeCmd =        0b1100; // 1 data Byte
+    static const uint8_t MonophonicAftertouchCmd =  0b1101; // 1 data Byte
+    static const uint8_t PitchBendCmd =             0b1110; // 2 data Bytes
+    // --> a command with a form of 0b110xxxxx will have only one data byte
+    // 8 Bit commands
+    static const char SysExBegin =               0b11110000; // x data Bytes
+    static const uint8_t MIDITimecodeQuarterFrame = 0b11110001; // 1 data Byte
+    static const uint8_t SongPositionPointerCmd =   0b11110010; // 2 data Bytes
+    static const uint8_t SongSelectCmd =            0b11110011; // 1 data Byte
+    //  0b11110100 undefined
+    //  0b11110101 undefined
+    static const uint8_t TuneRequest =              0b11110110; // 0 data Bytes
+    static const char SysExEnd =                 0b11110111; // 0 data Bytes
+    static const uint8_t ClockTickCmd =             0b11111000; // 0 data Bytes
+    //  0b11111001 undefined
+    static const uint8_t StartCmd =                 0b11111010; // 0 data Bytes
+    static const uint8_t ContinueCmd =              0b11111011; // 0 data Bytes
+    static const uint8_t StopCmd =                  0b11111100; // 0 data Bytes
+    //  0b11111101 undefined
+    static const uint8_t ActiveSense =              0b11111110; // 0 data Bytes
+    static const uint8_t MIDIReset =                0b11111111;
+
+
+
+    enum Channel : uint8_t {
+        Channel1 = 0,
+        Channel2 = 1,
+        Channel3 = 2,
+        Channel4 = 3,
+        Channel5 = 4,
+        Channel6 = 5,
+        Channel7 = 6,
+        Channel8 = 7,
+        Channel9 = 8,
+        Channel10 = 9,
+        Channel11 = 10,
+        Channel12 = 11,
+        Channel13 = 12,
+        Channel14 = 13,
+        Channel15 = 14,
+        Channel16 = 15,
+        ChannelAny = 16
+    };
+
+    enum RetValue : int8_t {
+        NoErrorCheckingForSpeedReasons = 1,
+        Success = 0,
+        FirstArgumentOutOfRange = -1,
+        SecondArgumentOutOfRange = -2,
+        ThirdArgumentOutOfRange = -3,
+        FourthArgumentOutOfRange = -4,
+        MissingSysExStart = -5,
+        MissingSysExEnd = -6
+    };
+
+    //=========================================================================
+    // Message types for the receive message mask, they can be combined with |
+    // Channel messages use bits 0 - 6, numbered by their 4 bit command
+    static const uint32_t NoteOffMessages =                 1UL << (NoteOffCmd - 0b1000);
+    static const uint32_t NoteOnMessages =                  1UL << (NoteOnCmd - 0b1000);
+    static const uint32_t PolyphonicAftertouchMessages =    1UL << (PolyphonicAftertouchCmd - 0b1000);
+    static const uint32_t ControlChangeMessages =           1UL << (ControlChangeCmd - 0b1000);
+    static const uint32_t ProgramChangeMessages =           1UL << (ProgrammChangeCmd - 0b1000);
+    static const uint32_t MonophonicAftertouchMessages =    1UL << (MonophonicAftertouchCmd - 0b1000);
+    static const uint32_t PitchBendMessages =               1UL << (PitchBendCmd - 0b1000);
+    // System messages use bits 16 - 31, numbered by the lower 4 bits of their 8 bit command
+    static const uint32_t SysExMessages =                   1UL << 16;
+    static const uint32_t MIDITimecodeQuarterFrameMessages = 1UL << 17;
+    static const uint32_t SongPositionPointerMessages =     1UL << 18;
+    static const uint32_t SongSelectMessages =              1UL << 19;
+    static const uint32_t TuneRequestMessages =             1UL << 22;
+    static const uint32_t ClockTickMessages =               1UL << 24;
+    static const uint32_t StartMessages =                   1UL << 26;
+    static const uint32_t ContinueMessages =                1UL << 27;
+    static const uint32_t StopMessages =                    1UL << 28;
+    static const uint32_t ActiveSenseMessages =             1UL << 30;
+    static const uint32_t ResetMessages =                   1UL << 31;
+    // The undefined commands and a SysEx end without a SysEx begin, all reported through receivedUnknownCommand()
+    static const uint32_t UnknownMessages =                 (1UL << 20) | (1UL << 21) | (1UL << 23) | (1UL << 25) | (1UL << 29);
+
+    static const uint32_t NoteMessages =                    NoteOffMessages | NoteOnMessages;
+    static const uint32_t AftertouchMessages =              PolyphonicAftertouchMessages | MonophonicAftertouchMessages;
+    static const uint32_t AllMessages =                     0xFFFFFFFF;
+
+    /** Returns the bit of the message type with the status byte passed in the receive message mask */
+    static uint32_t messageTypeBit (uint8_t status) {
+        if (status < 0b11110000)
+            return 1UL << ((status >> 4) - 0b1000);
+        return 1UL << (16 + (status & 0b00001111));
+    }
+
+    /**
+     * This value indicates, that the Aftertouch event was no polyphonic Aftertouch event, related to a special
+     * note but a monophonic aftertouch event
+     */
+    static const uint8_t MonophonicAftertouch = 255;
+};
+
+#endif /* MIDIDefinitions_h */
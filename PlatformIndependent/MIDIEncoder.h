@@ -0,0 +1,349 @@
+//
+//  MIDIEncoder.h
+//
+//  Turns MIDI messages into their wire format
+//
+
+#ifndef MIDIEncoder_h
+#define MIDIEncoder_h
+
+#include "MIDIDefinitions.h"
+#include "MIDIEvent.h"
+#include <stddef.h>
+
+// With C++14 the encoders are constexpr, so messages with constant arguments can be encoded at compile time.
+// Older compilers like the one of the Arduino IDE still get them as inline functions
+#if __cplusplus >= 201402L
+#define SIMPLE_MIDI_CONSTEXPR constexpr
+#else
+#define SIMPLE_MIDI_CONSTEXPR inline
+#endif
+
+// Each encoder writes one complete message to the buffer passed and returns the number of bytes written. No range
+// checks take place here, this is up to the caller. The channel is passed as 0 - 15. The encoders don't need a
+// SimpleMIDI instance, so they can be used to build byte streams for files, network packets and the like.
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeNoteOn (uint8_t channel, uint8_t note, uint8_t velocity, uint8_t *out) {
+    out[0] = MIDIDefinitions::NoteOnCmd << 4 | channel;
+    out[1] = note;
+    out[2] = velocity;
+    return 3;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeNoteOff (uint8_t channel, uint8_t note, uint8_t velocity, uint8_t *out) {
+    out[0] = MIDIDefinitions::NoteOffCmd << 4 | channel;
+    out[1] = note;
+    out[2] = velocity;
+    return 3;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodePolyphonicAftertouch (uint8_t channel, uint8_t note, uint8_t velocity, uint8_t *out) {
+    out[0] = MIDIDefinitions::PolyphonicAftertouchCmd << 4 | channel;
+    out[1] = note;
+    out[2] = velocity;
+    return 3;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeMonophonicAftertouch (uint8_t channel, uint8_t velocity, uint8_t *out) {
+    out[0] = MIDIDefinitions::MonophonicAftertouchCmd << 4 | channel;
+    out[1] = velocity;
+    return 2;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeControlChange (uint8_t channel, uint8_t control, uint8_t value, uint8_t *out) {
+    out[0] = MIDIDefinitions::ControlChangeCmd << 4 | channel;
+    out[1] = control;
+    out[2] = value;
+    return 3;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeProgramChange (uint8_t channel, uint8_t program, uint8_t *out) {
+    out[0] = MIDIDefinitions::ProgrammChangeCmd << 4 | channel;
+    out[1] = program;
+    return 2;
+}
+
+/** The pitch is biased arround 0 with a range from -8192 to 8191 */
+SIMPLE_MIDI_CONSTEXPR uint8_t encodePitchBend (uint8_t channel, int16_t pitch, uint8_t *out) {
+    // the wire format is an unsigned 14 bit value with 8192 meaning no pitch bend, lsb first
+    const uint16_t unsignedPitch = pitch + 8192;
+    out[0] = MIDIDefinitions::PitchBendCmd << 4 | channel;
+    out[1] = unsignedPitch & 0x7F;
+    out[2] = (unsignedPitch >> 7) & 0x7F;
+    return 3;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeMIDITimecodeQuarterFrame (uint8_t quarterFrame, uint8_t *out) {
+    out[0] = MIDIDefinitions::MIDITimecodeQuarterFrame;
+    out[1] = quarterFrame;
+    return 2;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeSongPositionPointer (uint16_t positionInBeats, uint8_t *out) {
+    out[0] = MIDIDefinitions::SongPositionPointerCmd;
+    out[1] = positionInBeats & 0x7F;
+    out[2] = (positionInBeats >> 7) & 0x7F;
+    return 3;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeSongSelect (uint8_t songToSelect, uint8_t *out) {
+    out[0] = MIDIDefinitions::SongSelectCmd;
+    out[1] = songToSelect;
+    return 2;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeTuneRequest (uint8_t *out) {
+    out[0] = MIDIDefinitions::TuneRequest;
+    return 1;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeMIDIClockTick (uint8_t *out) {
+    out[0] = MIDIDefinitions::ClockTickCmd;
+    return 1;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeMIDIStart (uint8_t *out) {
+    out[0] = MIDIDefinitions::StartCmd;
+    return 1;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeMIDIStop (uint8_t *out) {
+    out[0] = MIDIDefinitions::StopCmd;
+    return 1;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeMIDIContinue (uint8_t *out) {
+    out[0] = MIDIDefinitions::ContinueCmd;
+    return 1;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeActiveSense (uint8_t *out) {
+    out[0] = MIDIDefinitions::ActiveSense;
+    return 1;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeReset (uint8_t *out) {
+    out[0] = MIDIDefinitions::MIDIReset;
+    return 1;
+}
+
+/** Frames the SysEx data passed, which must not contain SysExBegin and SysExEnd. The buffer needs length + 2 bytes */
+SIMPLE_MIDI_CONSTEXPR size_t encodeSysEx (const uint8_t *data, size_t length, uint8_t *out) {
+    out[0] = (uint8_t)MIDIDefinitions::SysExBegin;
+    for (size_t i = 0; i < length; i++)
+        out[i + 1] = data[i];
+    out[length + 1] = (uint8_t)MIDIDefinitions::SysExEnd;
+    return length + 2;
+}
+
+// (N)RPN messages are made of control changes that select the 14 bit parameter number and data entry control
+// changes that carry the value. The parts can be sent on their own, e.g. to change the value of a parameter that
+// is already selected
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeNRPNSelect (uint8_t channel, uint16_t parameter, uint8_t *out) {
+    encodeControlChange (channel, 99, (parameter >> 7) & 0x7F, out);
+    encodeControlChange (channel, 98, parameter & 0x7F, out + 3);
+    return 6;
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeRPNSelect (uint8_t channel, uint16_t parameter, uint8_t *out) {
+    encodeControlChange (channel, 101, (parameter >> 7) & 0x7F, out);
+    encodeControlChange (channel, 100, parameter & 0x7F, out + 3);
+    return 6;
+}
+
+/** Selects the RPN null parameter, so that following data entry messages have no effect */
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeRPNNull (uint8_t channel, uint8_t *out) {
+    return encodeRPNSelect (channel, 0x3FFF, out);
+}
+
+/** Data entry MSB and LSB of a 14 bit value in the range from 0 - 16383 */
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeHiResDataEntry (uint8_t channel, uint16_t value, uint8_t *out) {
+    encodeControlChange (channel, 6, (value >> 7) & 0x7F, out);
+    encodeControlChange (channel, 38, value & 0x7F, out + 3);
+    return 6;
+}
+
+/** Data entry MSB of a 7 bit value in the range from 0 - 127 */
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeLoResDataEntry (uint8_t channel, uint8_t value, uint8_t *out) {
+    return encodeControlChange (channel, 6, value, out);
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeHiResNRPN (uint8_t channel, uint16_t parameter, uint16_t value, uint8_t *out) {
+    return encodeNRPNSelect (channel, parameter, out) + encodeHiResDataEntry (channel, value, out + 6);
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeLoResNRPN (uint8_t channel, uint16_t parameter, uint8_t value, uint8_t *out) {
+    return encodeNRPNSelect (channel, parameter, out) + encodeLoResDataEntry (channel, value, out + 6);
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeHiResRPN (uint8_t channel, uint16_t parameter, uint16_t value, uint8_t *out) {
+    return encodeRPNSelect (channel, parameter, out) + encodeHiResDataEntry (channel, value, out + 6);
+}
+
+SIMPLE_MIDI_CONSTEXPR uint8_t encodeLoResRPN (uint8_t channel, uint16_t parameter, uint8_t value, uint8_t *out) {
+    return encodeRPNSelect (channel, parameter, out) + encodeLoResDataEntry (channel, value, out + 6);
+}
+
+/** Returns the length of a message with a fixed size from its status byte, 1 for SysEx and unknown commands */
+SIMPLE_MIDI_CONSTEXPR uint8_t encodedLength (uint8_t status) {
+    return (status < 0b11110000) ? (((status & 0b11100000) == 0b11000000) ? 2 : 3)
+         : ((status == MIDIDefinitions::MIDITimecodeQuarterFrame) || (status == MIDIDefinitions::SongSelectCmd)) ? 2
+         : (status == MIDIDefinitions::SongPositionPointerCmd) ? 3
+         : 1;
+}
+
+/**
+ * Encodes a sequence of events as returned by SimpleMIDI::poll() into one contiguous buffer. Encoding stops at the
+ * first event that doesn't fit into the buffer anymore. With running status, status bytes of channel messages
+ * are left out if they repeat the one before, as in standard MIDI files.
+ * @param numBytesWritten   Set to the number of bytes written to the buffer
+ * @return                  The number of events that were encoded
+ */
+SIMPLE_MIDI_CONSTEXPR size_t encodeEvents (const MIDIEvent *events, size_t numEvents, uint8_t *out, size_t capacity,
+                                           size_t &numBytesWritten, bool useRunningStatus = false) {
+    size_t position = 0;
+    uint8_t runningStatus = 0;
+    size_t i = 0;
+
+    for (; i < numEvents; i++) {
+        const uint8_t status = events[i].status;
+        const uint8_t messageLength = encodedLength (status);
+        const bool skipStatus = useRunningStatus && (status == runningStatus);
+        if (position + messageLength - (skipStatus ? 1 : 0) > capacity)
+            break;
+
+        // system common messages end the running status, realtime messages don't affect it
+        if (status < 0b11110000)
+            runningStatus = status;
+        else if (status < 0b11111000)
+            runningStatus = 0;
+
+        if (!skipStatus)
+            out[position++] = status;
+        if (messageLength > 1)
+            out[position++] = events[i].data1;
+        if (messageLength > 2)
+            out[position++] = events[i].data2;
+    }
+
+    numBytesWritten = position;
+    return i;
+}
+
+/**
+ * A single message encoded to a small fixed size buffer, that can be passed to SimpleMIDI::send(). With C++14 the
+ * factories are constexpr, so messages with fixed arguments are encoded at compile time:
+ *
+ *      static constexpr MIDIMessage allNotesOff = MIDIMessage::controlChange (0, 123, 0);
+ *      midi.send (allNotesOff);
+ */
+struct MIDIMessage {
+
+    uint8_t bytes[3];
+    uint8_t length;
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage noteOn (uint8_t channel, uint8_t note, uint8_t velocity) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeNoteOn (channel, note, velocity, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage noteOff (uint8_t channel, uint8_t note, uint8_t velocity) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeNoteOff (channel, note, velocity, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage polyphonicAftertouch (uint8_t channel, uint8_t note, uint8_t velocity) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodePolyphonicAftertouch (channel, note, velocity, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage monophonicAftertouch (uint8_t channel, uint8_t velocity) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeMonophonicAftertouch (channel, velocity, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage controlChange (uint8_t channel, uint8_t control, uint8_t value) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeControlChange (channel, control, value, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage programChange (uint8_t channel, uint8_t program) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeProgramChange (channel, program, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage pitchBend (uint8_t channel, int16_t pitch) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodePitchBend (channel, pitch, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage timecodeQuarterFrame (uint8_t quarterFrame) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeMIDITimecodeQuarterFrame (quarterFrame, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage songPositionPointer (uint16_t positionInBeats) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeSongPositionPointer (positionInBeats, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage songSelect (uint8_t songToSelect) {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeSongSelect (songToSelect, m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage tuneRequest() {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeTuneRequest (m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage clockTick() {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeMIDIClockTick (m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage clockStart() {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeMIDIStart (m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage clockStop() {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeMIDIStop (m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage clockContinue() {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeMIDIContinue (m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage activeSense() {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeActiveSense (m.bytes);
+        return m;
+    }
+
+    static SIMPLE_MIDI_CONSTEXPR MIDIMessage reset() {
+        MIDIMessage m = {{0, 0, 0}, 0};
+        m.length = encodeReset (m.bytes);
+        return m;
+    }
+};
+
+#endif /* MIDIEncoder_h */
@@ -0,0 +1,80 @@
+//
+//  MIDIEvent.h
+//
+//  Compact representation of a single decoded MIDI message
+//
+
+#ifndef MIDIEvent_h
+#define MIDIEvent_h
+
+#include <stdint.h>
+
+/**
+ * A decoded MIDI message as returned by SimpleMIDI::poll(). It is a plain struct of 8 bytes, so that a batch of
+ * them can be copied around with memcpy and a whole audio block worth of events fits into a few cache lines.
+ *
+ * Channel messages keep their complete status byte, e.g. 0x93 for a note on at channel 4, system messages
+ * carry their 8 bit command as status. Messages with only one data byte have data2 set to 0. SysEx messages
+ * have no fixed size and are therefore never turned into an event, they always go to the receivedSysExXYZ()
+ * callbacks.
+ */
+struct MIDIEvent {
+
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint8_t reserved;
+
+    /**
+     * Lower 32 bits of the receive time in microseconds, which wrap around about every 71 minutes. Use
+     * getTimestamp() to get the full time in nanoseconds.
+     */
+    uint32_t timestamp;
+
+    /**
+     * Restores the full receive time in nanoseconds of the MIDITimestamp clock, with microsecond resolution.
+     * Reference is any timestamp taken less than 35 minutes before or after the event was received, so reading
+     * MIDITimestamp::now() once after each poll() and passing it to all events polled is enough.
+     */
+    uint64_t getTimestamp (uint64_t reference) const {
+        const uint64_t referenceMicroseconds = reference / 1000;
+        return (referenceMicroseconds + (int64_t)(int32_t)(timestamp - (uint32_t)referenceMicroseconds)) * 1000;
+    }
+
+    /** True for notes, aftertouch, control changes, program changes and pitch bends */
+    bool isChannelMessage() const {
+        return status < 0b11110000;
+    }
+
+    /** Returns one of the 4 bit commands like SimpleMIDI::NoteOnCmd for channel messages */
+    uint8_t getCommand() const {
+        return status >> 4;
+    }
+
+    /** Returns the channel in the range from 0 - 15, only valid for channel messages */
+    uint8_t getChannel() const {
+        return status & 0b00001111;
+    }
+
+    /** True for a note on with a velocity greater than 0 */
+    bool isNoteOn() const {
+        return ((status >> 4) == 0b1001) && (data2 != 0);
+    }
+
+    /** True for a note off and for a note on with velocity 0 */
+    bool isNoteOff() const {
+        return ((status >> 4) == 0b1000) || (((status >> 4) == 0b1001) && (data2 == 0));
+    }
+
+    /** Combines both data bytes of a pitch bend to a value ranging from -8192 to 8191 */
+    int16_t getPitchBend() const {
+        return (int16_t)(data1 | (data2 << 7)) - 8192;
+    }
+
+    /** Combines both data bytes of a song position pointer to a value ranging from 0 to 16383 */
+    uint16_t getSongPosition() const {
+        return data1 | (data2 << 7);
+    }
+};
+
+#endif /* MIDIEvent_h */
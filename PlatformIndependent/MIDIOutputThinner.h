@@ -0,0 +1,301 @@
+//
+//  MIDIOutputThinner.h
+//
+//  Drops redundant control changes, pitch bends and channel pressure messages from the outgoing stream
+//
+
+#ifndef MIDIOutputThinner_h
+#define MIDIOutputThinner_h
+
+#include <stdint.h>
+
+/**
+ * Keeps the last value sent for each controller, pitch bend and channel pressure of all 16 channels in a dense
+ * table and decides for each outgoing message of these types if it has to go over the wire. A message that
+ * carries the same value as the last one sent is dropped. If a minimum interval is set, each controller sends
+ * at most one message per interval; values arriving within the interval replace each other and only the latest
+ * one is sent when the interval is over, so the receiver always ends up with the final value.
+ *
+ * Data entry, increment, decrement, the (N)RPN parameter numbers and the channel mode messages are never
+ * thinned, as their meaning depends on the messages around them.
+ *
+ * Controllers 32 to 63 are the LSBs of the 14 bit controllers 0 to 31, and a receiver resets the LSB whenever a new
+ * MSB arrives. Sending an MSB therefore forgets the LSB sent last, so the next LSB goes out even if it carries the
+ * same value. While an MSB waits for the end of its interval, its LSB waits behind it and is sent right after it.
+ *
+ * The tables take about 17 kB, so the thinner is only created by SimpleMIDI when thinning is enabled.
+ */
+class MIDIOutputThinner {
+
+public:
+
+    // Slot of pitch bend and channel pressure next to the 128 controllers of each channel
+    static const uint8_t PitchBendSlot = 128;
+    static const uint8_t ChannelPressureSlot = 129;
+    static const uint8_t NumSlots = 130;
+
+    MIDIOutputThinner (uint32_t minIntervalMicroseconds)
+      : minInterval (minIntervalMicroseconds), numPending (0), numDuplicatesSuppressed (0), numRateLimitedSuppressed (0) {
+        reset();
+    }
+
+    /** Forgets all values sent and pending, so that the next value of each controller is sent in any case */
+    void reset() {
+        for (uint8_t channel = 0; channel < 16; channel++) {
+            for (uint8_t slot = 0; slot < NumSlots; slot++) {
+                lastSent[channel][slot] = NoValue;
+                pending[channel][slot] = NoValue;
+                windowStart[channel][slot] = 0;
+            }
+        }
+        numPending = 0;
+    }
+
+    void setMinInterval (uint32_t minIntervalMicroseconds) {
+        minInterval = minIntervalMicroseconds;
+    }
+
+    uint32_t getMinInterval() const {
+        return minInterval;
+    }
+
+    /**
+     * Returns false if the message passed must not be sent now. It is either a duplicate or it was stored to be
+     * sent by popDueMessage() at the end of the controller's interval. Messages of other types always return true.
+     */
+    bool shouldSend (const uint8_t *message, int length, uint32_t nowMicroseconds) {
+        uint8_t channel, slot;
+        uint16_t value;
+        if (!decode (message, length, channel, slot, value))
+            return true;
+
+        if (isHiResLSB (slot))
+            return shouldSendLSB (channel, slot, value);
+
+        if (value == lastSent[channel][slot]) {
+            // a newer value is waiting, but the value went back to the one the receiver already has
+            if (pending[channel][slot] != NoValue) {
+                pending[channel][slot] = NoValue;
+                numPending--;
+                numRateLimitedSuppressed++;
+            }
+            numDuplicatesSuppressed++;
+            return false;
+        }
+
+        if ((lastSent[channel][slot] != NoValue) && (nowMicroseconds - windowStart[channel][slot] < minInterval)) {
+            if (pending[channel][slot] == NoValue)
+                numPending++;
+            else
+                numRateLimitedSuppressed++;
+            pending[channel][slot] = value;
+            return false;
+        }
+
+        dropPending (channel, slot);
+        lastSent[channel][slot] = value;
+        windowStart[channel][slot] = nowMicroseconds;
+
+        // an LSB still waiting belonged to an older MSB, the receiver resets it when this one arrives
+        if (isHiResMSB (slot)) {
+            dropPending (channel, slot + 32);
+            lastSent[channel][slot + 32] = NoValue;
+        }
+        return true;
+    }
+
+    /**
+     * Writes the next pending message whose interval is over to the buffer passed and returns its length, or 0 if
+     * there is none. The buffer must hold 3 bytes.
+     */
+    int popDueMessage (uint8_t *message, uint32_t nowMicroseconds) {
+        if (numPending == 0)
+            return 0;
+
+        for (uint8_t channel = 0; channel < 16; channel++) {
+            for (uint8_t slot = 0; slot < NumSlots; slot++) {
+                const uint16_t value = pending[channel][slot];
+                if ((value == NoValue) || !isDue (channel, slot, nowMicroseconds))
+                    continue;
+
+                pending[channel][slot] = NoValue;
+                numPending--;
+                lastSent[channel][slot] = value;
+                windowStart[channel][slot] = nowMicroseconds;
+
+                // a waiting LSB is due now and follows with the next call
+                if (isHiResMSB (slot))
+                    lastSent[channel][slot + 32] = NoValue;
+                return encode (channel, slot, value, message);
+            }
+        }
+        return 0;
+    }
+
+    /** Returns the number of microseconds until the next pending message is due or -1 if nothing is pending */
+    int64_t getMicrosecondsUntilNextDue (uint32_t nowMicroseconds) const {
+        if (numPending == 0)
+            return -1;
+
+        int64_t earliest = minInterval;
+        for (uint8_t channel = 0; channel < 16; channel++) {
+            for (uint8_t slot = 0; slot < NumSlots; slot++) {
+                if (pending[channel][slot] == NoValue)
+                    continue;
+
+                // an LSB is due as soon as its MSB went out
+                if (isHiResLSB (slot)) {
+                    if (pending[channel][slot - 32] == NoValue)
+                        return 0;
+                    continue;
+                }
+
+                const uint32_t elapsed = nowMicroseconds - windowStart[channel][slot];
+                if (elapsed >= minInterval)
+                    return 0;
+                if (minInterval - elapsed < earliest)
+                    earliest = minInterval - elapsed;
+            }
+        }
+        return earliest;
+    }
+
+    uint16_t getNumPending() const {
+        return numPending;
+    }
+
+    /** Number of messages dropped because they carried the value that was sent before */
+    uint32_t getNumDuplicatesSuppressed() const {
+        return numDuplicatesSuppressed;
+    }
+
+    /** Number of messages dropped because a newer value of the same controller replaced them within the interval */
+    uint32_t getNumRateLimitedSuppressed() const {
+        return numRateLimitedSuppressed;
+    }
+
+    void resetCounters() {
+        numDuplicatesSuppressed = 0;
+        numRateLimitedSuppressed = 0;
+    }
+
+private:
+
+    static const uint16_t NoValue = 0xFFFF;
+
+    uint32_t minInterval;
+    uint16_t numPending;
+    uint32_t numDuplicatesSuppressed;
+    uint32_t numRateLimitedSuppressed;
+
+    uint16_t lastSent[16][NumSlots];
+    uint16_t pending[16][NumSlots];
+    uint32_t windowStart[16][NumSlots];
+
+    static bool isHiResMSB (uint8_t slot) {
+        return slot < 32;
+    }
+
+    static bool isHiResLSB (uint8_t slot) {
+        return (slot >= 32) && (slot < 64);
+    }
+
+    bool isDue (uint8_t channel, uint8_t slot, uint32_t nowMicroseconds) const {
+        if (isHiResLSB (slot))
+            return pending[channel][slot - 32] == NoValue;
+        return nowMicroseconds - windowStart[channel][slot] >= minInterval;
+    }
+
+    void dropPending (uint8_t channel, uint8_t slot) {
+        if (pending[channel][slot] != NoValue) {
+            pending[channel][slot] = NoValue;
+            numPending--;
+            numRateLimitedSuppressed++;
+        }
+    }
+
+    /** LSBs aren't rate limited on their own, they only wait if their MSB waits */
+    bool shouldSendLSB (uint8_t channel, uint8_t slot, uint16_t value) {
+        if (pending[channel][slot - 32] != NoValue) {
+            if (pending[channel][slot] == NoValue)
+                numPending++;
+            else
+                numRateLimitedSuppressed++;
+            pending[channel][slot] = value;
+            return false;
+        }
+
+        dropPending (channel, slot);
+        if (value == lastSent[channel][slot]) {
+            numDuplicatesSuppressed++;
+            return false;
+        }
+
+        lastSent[channel][slot] = value;
+        return true;
+    }
+
+    static bool decode (const uint8_t *message, int length, uint8_t &channel, uint8_t &slot, uint16_t &value) {
+        if (length < 2)
+            return false;
+
+        channel = message[0] & 0b00001111;
+
+        switch (message[0] >> 4) {
+            case 0b1011:
+                if ((length != 3) || !isThinnable (message[1]))
+                    return false;
+                slot = message[1];
+                value = message[2];
+                return true;
+
+            case 0b1110:
+                if (length != 3)
+                    return false;
+                slot = PitchBendSlot;
+                value = message[1] | (message[2] << 7);
+                return true;
+
+            case 0b1101:
+                if (length != 2)
+                    return false;
+                slot = ChannelPressureSlot;
+                value = message[1];
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+    static bool isThinnable (uint8_t controller) {
+        // data entry MSB and LSB
+        if ((controller == 6) || (controller == 38))
+            return false;
+        // data increment, decrement and the NRPN and RPN parameter numbers
+        if ((controller >= 96) && (controller <= 101))
+            return false;
+        // channel mode messages like all notes off
+        return controller < 120;
+    }
+
+    static int encode (uint8_t channel, uint8_t slot, uint16_t value, uint8_t *message) {
+        if (slot == PitchBendSlot) {
+            message[0] = 0b11100000 | channel;
+            message[1] = value & 0b01111111;
+            message[2] = value >> 7;
+            return 3;
+        }
+        if (slot == ChannelPressureSlot) {
+            message[0] = 0b11010000 | channel;
+            message[1] = (uint8_t)value;
+            return 2;
+        }
+        message[0] = 0b10110000 | channel;
+        message[1] = slot;
+        message[2] = (uint8_t)value;
+        return 3;
+    }
+};
+
+#endif /* MIDIOutputThinner_h */
@@ -0,0 +1,301 @@
+//
+//  MIDIParameterAssembler.h
+//
+//  Combines incoming (N)RPN sequences and 14 bit controller pairs into single values
+//
+
+#ifndef MIDIParameterAssembler_h
+#define MIDIParameterAssembler_h
+
+#include <stdint.h>
+
+/**
+ * Rebuilds the messages that MIDI splits into several control changes, for each of the 16 channels:
+ * - NRPNs (CC 99 and 98 select the parameter) and RPNs (CC 101 and 100), with their values sent by data entry
+ *   MSB (CC 6) and LSB (CC 38), data increment (CC 96) and data decrement (CC 97)
+ * - 14 bit controllers, made of the MSB on CC 0 - 31 and the LSB on the controller 32 above it
+ *
+ * Complete values are passed to the receiver's receivedNRPN(), receivedRPN() and receivedHiResControlChange().
+ * Control changes that don't belong to one of these messages, e.g. a data entry without a selected parameter or
+ * an LSB without an MSB, are left to receivedControlChange().
+ *
+ * An MSB alone is a valid message, the LSB is optional. In EmitOnMSB mode, the value is passed on as soon as the
+ * MSB arrives, with an LSB of 0, and passed on again with the LSB if that follows. In WaitForLSB mode, the MSB waits
+ * for its LSB up to a timeout, so the receiver only sees one value per change. The receiver has to call
+ * expirePendingMSBs() regularly to deliver the MSBs that never got an LSB; expiry is checked on every control
+ * change as well.
+ *
+ * Data increment and decrement change the last value of the selected parameter by one and are only handled once
+ * a value of that parameter was received.
+ *
+ * All state is kept in a fixed size table, nothing is allocated while messages are received.
+ */
+template <typename Receiver>
+class MIDIParameterAssembler {
+
+public:
+
+    enum Mode : uint8_t {
+        EmitOnMSB,
+        WaitForLSB
+    };
+
+    MIDIParameterAssembler (bool shouldAssembleParameterNumbers, bool shouldAssembleHiResControlChanges)
+      : assembleParameterNumbers (shouldAssembleParameterNumbers),
+        assembleHiResControlChanges (shouldAssembleHiResControlChanges),
+        mode (EmitOnMSB),
+        timeout (10000),
+        channelsWithPendingMSBs (0) {
+        reset();
+    }
+
+    void setMode (Mode newMode, uint32_t lsbTimeoutMicroseconds) {
+        mode = newMode;
+        timeout = lsbTimeoutMicroseconds;
+    }
+
+    /** Forgets all selected parameters and received MSBs */
+    void reset() {
+        for (uint8_t channel = 0; channel < 16; channel++) {
+            ChannelState &state = channels[channel];
+            state.parameter = 0;
+            state.parameterType = NoParameter;
+            state.dataEntryMSB = NoValue;
+            state.dataEntryPending = false;
+            state.value = NoValue14Bit;
+            state.pendingHiResMSBs = 0;
+            state.pendingSince = 0;
+            for (uint8_t control = 0; control < 32; control++)
+                state.hiResMSB[control] = NoValue;
+        }
+        channelsWithPendingMSBs = 0;
+    }
+
+    /**
+     * Feeds a received control change. Returns true if it was part of a combined message and must not be passed
+     * to receivedControlChange().
+     */
+    bool controlChange (Receiver &receiver, uint8_t channel, uint8_t control, uint8_t value, uint32_t nowMicroseconds) {
+        if (channelsWithPendingMSBs != 0)
+            expirePendingMSBs (receiver, nowMicroseconds);
+
+        ChannelState &state = channels[channel];
+
+        if (assembleParameterNumbers) {
+            switch (control) {
+                case 99:
+                case 101:
+                    selectParameter (receiver, channel, control == 101 ? RPN : NRPN, (value << 7) | (state.parameter & 0b01111111), true);
+                    return true;
+
+                case 98:
+                case 100:
+                    selectParameter (receiver, channel, control == 100 ? RPN : NRPN, (state.parameter & 0b0011111110000000) | value, false);
+                    return true;
+
+                case 6:
+                    if (!hasSelectedParameter (state))
+                        break;
+
+                    state.dataEntryMSB = value;
+                    state.value = value << 7;
+                    if (mode == EmitOnMSB) {
+                        emitParameter (receiver, state);
+                    }
+                    else {
+                        state.dataEntryPending = true;
+                        markPending (channel, nowMicroseconds);
+                    }
+                    return true;
+
+                case 38:
+                    if (!hasSelectedParameter (state) || (state.dataEntryMSB == NoValue))
+                        break;
+
+                    state.dataEntryPending = false;
+                    clearPendingIfComplete (channel);
+                    state.value = (state.dataEntryMSB << 7) | value;
+                    emitParameter (receiver, state);
+                    return true;
+
+                case 96:
+                case 97:
+                    if (!hasSelectedParameter (state) || (state.value == NoValue14Bit))
+                        break;
+
+                    state.dataEntryPending = false;
+                    clearPendingIfComplete (channel);
+                    if ((control == 96) && (state.value < 0b0011111111111111))
+                        state.value++;
+                    else if ((control == 97) && (state.value > 0))
+                        state.value--;
+                    emitParameter (receiver, state);
+                    return true;
+
+                default:
+                    break;
+            }
+        }
+
+        if (!assembleHiResControlChanges || (control >= 64))
+            return false;
+
+        if (control < 32) {
+            const uint32_t bit = 1UL << control;
+            if (state.pendingHiResMSBs & bit)
+                receiver.receivedHiResControlChange (control, state.hiResMSB[control] << 7);
+
+            state.hiResMSB[control] = value;
+            if (mode == EmitOnMSB) {
+                receiver.receivedHiResControlChange (control, value << 7);
+            }
+            else {
+                state.pendingHiResMSBs |= bit;
+                markPending (channel, nowMicroseconds);
+            }
+            return true;
+        }
+
+        const uint8_t msbControl = control - 32;
+        if (state.hiResMSB[msbControl] == NoValue)
+            return false;
+
+        state.pendingHiResMSBs &= ~(1UL << msbControl);
+        clearPendingIfComplete (channel);
+        receiver.receivedHiResControlChange (msbControl, (state.hiResMSB[msbControl] << 7) | value);
+        return true;
+    }
+
+    /** Passes on all MSBs that waited for their LSB longer than the timeout */
+    void expirePendingMSBs (Receiver &receiver, uint32_t nowMicroseconds) {
+        for (uint8_t channel = 0; channel < 16; channel++) {
+            if (((channelsWithPendingMSBs >> channel) & 1) == 0)
+                continue;
+            if (nowMicroseconds - channels[channel].pendingSince < timeout)
+                continue;
+
+            // the callbacks report the channel of the pending message, not the one of the current message
+            const typename Receiver::Channel currentChannel = receiver.lastChannel;
+            receiver.lastChannel = (typename Receiver::Channel)channel;
+            emitPending (receiver, channel);
+            receiver.lastChannel = currentChannel;
+        }
+    }
+
+    /** Returns the number of microseconds until the next pending MSB expires, or -1 if none is pending */
+    int64_t getMicrosecondsUntilExpiry (uint32_t nowMicroseconds) const {
+        if (channelsWithPendingMSBs == 0)
+            return -1;
+
+        int64_t earliest = timeout;
+        for (uint8_t channel = 0; channel < 16; channel++) {
+            if (((channelsWithPendingMSBs >> channel) & 1) == 0)
+                continue;
+
+            const uint32_t elapsed = nowMicroseconds - channels[channel].pendingSince;
+            if (elapsed >= timeout)
+                return 0;
+            if (timeout - elapsed < earliest)
+                earliest = timeout - elapsed;
+        }
+        return earliest;
+    }
+
+private:
+
+    static const uint8_t NoValue = 0x80;
+    static const uint16_t NoValue14Bit = 0xFFFF;
+    static const uint16_t NullRPN = 0b0011111111111111;
+
+    enum ParameterType : uint8_t {
+        NoParameter,
+        NRPN,
+        RPN
+    };
+
+    struct ChannelState {
+        uint16_t parameter;
+        ParameterType parameterType;
+        uint8_t dataEntryMSB;
+        bool dataEntryPending;
+        uint16_t value;
+
+        // Controllers 0 - 31 whose MSB waits for its LSB, and the time the oldest pending MSB of the channel arrived
+        uint32_t pendingHiResMSBs;
+        uint32_t pendingSince;
+        uint8_t hiResMSB[32];
+    };
+
+    bool assembleParameterNumbers;
+    bool assembleHiResControlChanges;
+    Mode mode;
+    uint32_t timeout;
+    uint16_t channelsWithPendingMSBs;
+    ChannelState channels[16];
+
+    void selectParameter (Receiver &receiver, uint8_t channel, ParameterType type, uint16_t parameter, bool isMSB) {
+        ChannelState &state = channels[channel];
+
+        // a value still waiting for its LSB belongs to the previous parameter
+        if (state.dataEntryPending) {
+            state.dataEntryPending = false;
+            emitParameter (receiver, state);
+        }
+
+        // switching between NRPN and RPN invalidates the other half of the number
+        if (state.parameterType != type)
+            parameter = isMSB ? (parameter & 0b0011111110000000) : (parameter & 0b01111111);
+
+        state.parameter = parameter;
+        state.parameterType = type;
+        state.dataEntryMSB = NoValue;
+        state.value = NoValue14Bit;
+    }
+
+    /**
+     * RPN 127 / 127 is the null parameter that deselects everything. It stays selected as an RPN, so that a
+     * following number byte of another RPN keeps the other half like any other RPN would
+     */
+    static bool hasSelectedParameter (const ChannelState &state) {
+        return (state.parameterType != NoParameter) && !((state.parameterType == RPN) && (state.parameter == NullRPN));
+    }
+
+    void emitParameter (Receiver &receiver, const ChannelState &state) {
+        if (state.parameterType == RPN)
+            receiver.receivedRPN (state.parameter, state.value);
+        else
+            receiver.receivedNRPN (state.parameter, state.value);
+    }
+
+    void markPending (uint8_t channel, uint32_t nowMicroseconds) {
+        if (((channelsWithPendingMSBs >> channel) & 1) == 0)
+            channels[channel].pendingSince = nowMicroseconds;
+        channelsWithPendingMSBs |= 1 << channel;
+    }
+
+    void clearPendingIfComplete (uint8_t channel) {
+        if (!channels[channel].dataEntryPending && (channels[channel].pendingHiResMSBs == 0))
+            channelsWithPendingMSBs &= ~(1 << channel);
+    }
+
+    void emitPending (Receiver &receiver, uint8_t channel) {
+        ChannelState &state = channels[channel];
+        channelsWithPendingMSBs &= ~(1 << channel);
+
+        if (state.dataEntryPending) {
+            state.dataEntryPending = false;
+            emitParameter (receiver, state);
+        }
+
+        for (uint8_t control = 0; state.pendingHiResMSBs != 0; control++) {
+            const uint32_t bit = 1UL << control;
+            if ((state.pendingHiResMSBs & bit) == 0)
+                continue;
+
+            state.pendingHiResMSBs &= ~bit;
+            receiver.receivedHiResControlChange (control, state.hiResMSB[control] << 7);
+        }
+    }
+};
+
+#endif /* MIDIParameterAssembler_h */
@@ -0,0 +1,80 @@
+//
+//  MIDIRunningStatus.h
+//
+//  Removes repeated status bytes from the outgoing byte stream
+//
+
+#ifndef MIDIRunningStatus_h
+#define MIDIRunningStatus_h
+
+#include <stdint.h>
+
+/**
+ * Keeps track of the last channel message status byte that was sent and decides for each outgoing byte if it
+ * has to go over the wire. A channel message with the same status byte as the one before can leave it out,
+ * which saves a third of the bandwidth for dense note or controller traffic. System common messages and SysEx
+ * end the running status, system realtime bytes don't touch it.
+ *
+ * As a receiver that is connected while a long run is going on can't decode anything until the next status
+ * byte, the status byte can be repeated after a number of omitted ones.
+ */
+class MIDIRunningStatusEncoder {
+
+public:
+
+    MIDIRunningStatusEncoder () : enabled (false), refreshInterval (0), lastStatus (0), numStatusBytesOmitted (0) {}
+
+    /**
+     * @param shouldBeEnabled       Enables or disables leaving out repeated status bytes
+     * @param statusRefreshInterval Number of status bytes that are left out in a row before the status byte is sent
+     *                              again anyway. 0 means it will only be sent when it changes
+     */
+    void setEnabled (bool shouldBeEnabled, uint16_t statusRefreshInterval) {
+        enabled = shouldBeEnabled;
+        refreshInterval = statusRefreshInterval;
+        reset ();
+    }
+
+    bool isEnabled () const {
+        return enabled;
+    }
+
+    /** Forces the next channel message to be sent with its status byte, e.g. after a device was reconnected */
+    void reset () {
+        lastStatus = 0;
+        numStatusBytesOmitted = 0;
+    }
+
+    /** Returns false if the byte passed is a status byte that can be left out */
+    bool shouldSend (const uint8_t byte) {
+        if (byte < 0b10000000)
+            return true;
+
+        // system realtime bytes may be interleaved with anything and don't affect the running status
+        if (byte >= 0b11111000)
+            return true;
+
+        // system common messages and SysEx end the running status
+        if (byte >= 0b11110000) {
+            lastStatus = 0;
+            return true;
+        }
+
+        if ((byte == lastStatus) && ((refreshInterval == 0) || (numStatusBytesOmitted < refreshInterval))) {
+            numStatusBytesOmitted++;
+            return false;
+        }
+
+        lastStatus = byte;
+        numStatusBytesOmitted = 0;
+        return true;
+    }
+
+private:
+    bool enabled;
+    uint16_t refreshInterval;
+    uint8_t lastStatus;
+    uint16_t numStatusBytesOmitted;
+};
+
+#endif /* MIDIRunningStatus_h */
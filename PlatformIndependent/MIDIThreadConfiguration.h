@@ -0,0 +1,188 @@
+//
+//  MIDIThreadConfiguration.h
+//
+//  Scheduling policy, CPU affinity and memory locking for the threads SimpleMIDI starts
+//
+
+#ifndef MIDIThreadConfiguration_h
+#define MIDIThreadConfiguration_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <alloca.h>
+
+/**
+ * Every thread SimpleMIDI starts applies the settings of its role right after it was started, before it does any
+ * work. Set them up before creating the ports, clock generators, schedulers or event loops whose threads should
+ * use them, threads that already run keep the settings they started with. The roles are:
+ * - Receive: the receive threads of TTYMIDIWrapper and VirtualMIDIPort
+ * - Send: the send and thinning threads of SimpleMIDI and the I/O thread of MIDIRealtimeSender
+ * - Timing: MIDIClockGenerator, MIDIOutputScheduler and MIDIWirePacer, whose jitter goes straight to the wire
+ * - EventLoop: the thread of a MIDIEventLoop, which receives and fires the timers of all ports added to it
+ *
+ * Realtime scheduling and memory locking need privileges, on Linux CAP_SYS_NICE and CAP_IPC_LOCK or a high enough
+ * RLIMIT_RTPRIO and RLIMIT_MEMLOCK. Settings that can't be applied are skipped, the thread then runs with the
+ * default settings of the system, and the failure is reported through getFailedSettings().
+ *
+ * Keep in mind that a SCHED_FIFO thread that never sleeps starves everything else on its core, e.g. a receive
+ * thread with busy polling. Pin it to a core of its own in this case.
+ */
+class MIDIThreadConfiguration {
+
+public:
+
+    enum Role : uint8_t {
+        Receive,
+        Send,
+        Timing,
+        EventLoop,
+        numRoles
+    };
+
+    enum Scheduling : uint8_t {
+        /** The normal time sharing scheduler of the system */
+        Default,
+        /** SCHED_FIFO: runs until it blocks, preempts all threads with the default scheduling */
+        FIFO,
+        /** SCHED_RR: like FIFO, but shares its core with threads of the same priority in time slices */
+        RoundRobin
+    };
+
+    /** Bits returned by getFailedSettings() */
+    enum Setting : uint8_t {
+        SchedulingSetting = 1,
+        AffinitySetting = 2
+    };
+
+    struct Settings {
+        Scheduling scheduling = Default;
+
+        /** Realtime priority from 1 to 99 for FIFO and RoundRobin, ignored for Default */
+        int priority = 0;
+
+        /** Indices of the cores the thread may run on, empty to let it run on all. Only supported on Linux */
+        std::vector<int> cpus;
+
+        /**
+         * Number of bytes at the top of the thread's stack that are touched once when the thread starts, so that
+         * their pages are already mapped when a callback needs them. Together with lockMemory() this keeps page
+         * faults off the realtime path. Keep it well below the stack size of the system, 8 MB by default on Linux
+         */
+        size_t stackBytesToPrefault = 0;
+    };
+
+    /** Sets the settings for all threads of the role passed that are started from now on */
+    static void set (Role role, const Settings &settings) {
+        std::lock_guard<std::mutex> lock (settingsMutex());
+        allSettings()[role] = settings;
+        failedSettings()[role].store (0, std::memory_order_relaxed);
+    }
+
+    static Settings get (Role role) {
+        std::lock_guard<std::mutex> lock (settingsMutex());
+        return allSettings()[role];
+    }
+
+    /**
+     * Returns the Setting bits of everything that couldn't be applied to at least one thread of the role since
+     * its settings were set, e.g. because the process lacks the privileges for realtime scheduling.
+     */
+    static uint8_t getFailedSettings (Role role) {
+        return failedSettings()[role].load (std::memory_order_relaxed);
+    }
+
+    /**
+     * Locks all pages of the process that are mapped now or later into memory, so that none of them is swapped out
+     * while a realtime thread needs it. This affects the whole process, not just the threads of SimpleMIDI.
+     * The stack of every thread started later is locked as a whole, so with a limited RLIMIT_MEMLOCK the next
+     * thread would fail to start. Memory is therefore only locked for root or if the limit is unlimited.
+     * @return  false if the process lacks the privileges or the memory lock limit is too low, nothing is locked then
+     */
+    static bool lockMemory() {
+        rlimit limit;
+        if ((geteuid() != 0) && ((getrlimit (RLIMIT_MEMLOCK, &limit) != 0) || (limit.rlim_cur != RLIM_INFINITY)))
+            return false;
+
+        return mlockall (MCL_CURRENT | MCL_FUTURE) == 0;
+    }
+
+    static void unlockMemory() {
+        munlockall();
+    }
+
+    /**
+     * Applies the settings of the role to the calling thread. SimpleMIDI calls this at the start of all its
+     * threads, call it from threads of your own that should be treated the same way.
+     * @return  The Setting bits of everything that couldn't be applied, 0 on success
+     */
+    static uint8_t applyToCurrentThread (Role role) {
+        const Settings settings = get (role);
+        uint8_t failed = 0;
+
+        if (!settings.cpus.empty()) {
+#ifdef __linux__
+            cpu_set_t cpuSet;
+            CPU_ZERO (&cpuSet);
+            for (size_t i = 0; i < settings.cpus.size(); i++) {
+                if ((settings.cpus[i] >= 0) && (settings.cpus[i] < CPU_SETSIZE))
+                    CPU_SET (settings.cpus[i], &cpuSet);
+            }
+            if (pthread_setaffinity_np (pthread_self(), sizeof (cpuSet), &cpuSet) != 0)
+                failed |= AffinitySetting;
+#else
+            failed |= AffinitySetting;
+#endif
+        }
+
+        if (settings.scheduling != Default) {
+            const int policy = (settings.scheduling == FIFO) ? SCHED_FIFO : SCHED_RR;
+            sched_param parameters;
+            parameters.sched_priority = settings.priority;
+            if (pthread_setschedparam (pthread_self(), policy, &parameters) != 0)
+                failed |= SchedulingSetting;
+        }
+
+        if (settings.stackBytesToPrefault > 0)
+            prefaultStack (settings.stackBytesToPrefault);
+
+        if (failed != 0)
+            failedSettings()[role].fetch_or (failed, std::memory_order_relaxed);
+        return failed;
+    }
+
+private:
+
+    // Function local statics keep this header only. They are initialized once on the first call
+    static std::mutex &settingsMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static Settings *allSettings() {
+        static Settings settings[numRoles];
+        return settings;
+    }
+
+    static std::atomic<uint8_t> *failedSettings() {
+        static std::atomic<uint8_t> failed[numRoles];
+        return failed;
+    }
+
+    // Not inlined, so the memory reserved by alloca is below the frame of the thread function and given back on return
+    __attribute__ ((noinline)) static void prefaultStack (size_t numBytes) {
+        volatile uint8_t *stack = (volatile uint8_t *)alloca (numBytes);
+        for (size_t i = 0; i < numBytes; i += 4096)
+            stack[i] = 0;
+        stack[numBytes - 1] = 0;
+    }
+};
+
+#endif /* MIDIThreadConfiguration_h */
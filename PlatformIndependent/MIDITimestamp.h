@@ -0,0 +1,215 @@
+//
+//  MIDITimestamp.h
+//
+//  Monotonic nanosecond clock used to timestamp incoming messages
+//
+
+#ifndef MIDITimestamp_h
+#define MIDITimestamp_h
+
+#include <stdint.h>
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+#include <atomic>
+#endif
+
+#ifdef SIMPLE_MIDI_TTY
+#include <time.h>
+#if defined (__x86_64__)
+#define SIMPLE_MIDI_TIMESTAMP_TSC
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+#elif defined SIMPLE_MIDI_MAC
+#include <mach/mach_time.h>
+#endif
+
+/**
+ * The clock behind all receive timestamps. Timestamps are nanoseconds counted from an arbitrary point in the past,
+ * they never jump backwards and are not affected by changes of the system time. Only differences between two
+ * timestamps are meaningful.
+ *
+ * The source is chosen once for the whole application:
+ * - MonotonicRaw (the default on Linux) is CLOCK_MONOTONIC_RAW, read through the vDSO without a system call
+ * - Monotonic is CLOCK_MONOTONIC, which is slewed by NTP but shares its time base with timers and sleeps
+ * - TSC reads the x86 time stamp counter directly, it takes only a few cycles. It is calibrated against
+ *   CLOCK_MONOTONIC_RAW when it is selected and only available if the CPU has an invariant TSC
+ * - MachAbsoluteTime is the only source on macOS, it is the time base CoreMIDI uses for its packets
+ * - ArduinoMicros is micros(), so the resolution is the one of the Arduino core's timer, typically 4 us
+ */
+class MIDITimestamp {
+
+public:
+
+    enum Source : uint8_t {
+        MonotonicRaw,
+        Monotonic,
+        TSC,
+        MachAbsoluteTime,
+        ArduinoMicros
+    };
+
+    /** Returns the current time in nanoseconds */
+    static uint64_t now () {
+        switch (getSource()) {
+#ifdef SIMPLE_MIDI_TTY
+            case MonotonicRaw:
+                return readClock (CLOCK_MONOTONIC_RAW);
+            case Monotonic:
+                return readClock (CLOCK_MONOTONIC);
+#endif
+#ifdef SIMPLE_MIDI_TIMESTAMP_TSC
+            case TSC: {
+                const TSCCalibration &c = tscCalibration();
+                return c.nanosecondsAtStart + (uint64_t)(((unsigned __int128)(__rdtsc() - c.ticksAtStart) * c.nanosecondsPerTick) >> 32);
+            }
+#endif
+#ifdef SIMPLE_MIDI_MAC
+            case MachAbsoluteTime:
+                return fromMachAbsoluteTime (mach_absolute_time());
+#endif
+#ifdef SIMPLE_MIDI_ARDUINO
+            case ArduinoMicros:
+                return (uint64_t)micros() * 1000;
+#endif
+            default:
+                return 0;
+        }
+    }
+
+    /**
+     * Switches the clock source for all timestamps taken from now on. It is safe to call while other threads take
+     * timestamps, but timestamps of different sources can't be compared, so better switch before any port is
+     * created.
+     * @return  false if the source is not available on this system, in this case the current one is kept
+     */
+    static bool setSource (Source source) {
+        if (!isSupported (source))
+            return false;
+
+#ifdef SIMPLE_MIDI_TIMESTAMP_TSC
+        if (source == TSC)
+            tscCalibration();
+#endif
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        // The calibration above is published by the initialization of its function local static, nothing else
+        // needs to be ordered with the source
+        selectedSource().store (source, std::memory_order_relaxed);
+#else
+        selectedSource() = source;
+#endif
+        return true;
+    }
+
+    static Source getSource () {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        return selectedSource().load (std::memory_order_relaxed);
+#else
+        return selectedSource();
+#endif
+    }
+
+    static bool isSupported (Source source) {
+        switch (source) {
+#ifdef SIMPLE_MIDI_TTY
+            case MonotonicRaw:
+            case Monotonic:
+                return true;
+#endif
+#ifdef SIMPLE_MIDI_TIMESTAMP_TSC
+            case TSC: {
+                // CPUID leaf 0x80000007, EDX bit 8: the TSC runs at a constant rate in all power states
+                unsigned int eax, ebx, ecx, edx;
+                if (!__get_cpuid (0x80000007, &eax, &ebx, &ecx, &edx))
+                    return false;
+                return (edx & (1 << 8)) != 0;
+            }
+#endif
+#ifdef SIMPLE_MIDI_MAC
+            case MachAbsoluteTime:
+                return true;
+#endif
+#ifdef SIMPLE_MIDI_ARDUINO
+            case ArduinoMicros:
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+#ifdef SIMPLE_MIDI_MAC
+    /** Converts a time stamp as found in a MIDIPacket to nanoseconds */
+    static uint64_t fromMachAbsoluteTime (uint64_t machTime) {
+        static mach_timebase_info_data_t timebase = {0, 0};
+        if (timebase.denom == 0)
+            mach_timebase_info (&timebase);
+        return machTime * timebase.numer / timebase.denom;
+    }
+#endif
+
+private:
+
+    static Source defaultSource () {
+#if defined SIMPLE_MIDI_MAC
+        return MachAbsoluteTime;
+#elif defined SIMPLE_MIDI_ARDUINO
+        return ArduinoMicros;
+#else
+        return MonotonicRaw;
+#endif
+    }
+
+    // Function local statics keep this header only. They are initialized once on the first call
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    static std::atomic<Source> &selectedSource () {
+        static std::atomic<Source> source (defaultSource());
+        return source;
+    }
+#else
+    static Source &selectedSource () {
+        static Source source = defaultSource();
+        return source;
+    }
+#endif
+
+#ifdef SIMPLE_MIDI_TTY
+    static uint64_t readClock (clockid_t clock) {
+        timespec t;
+        clock_gettime (clock, &t);
+        return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+    }
+#endif
+
+#ifdef SIMPLE_MIDI_TIMESTAMP_TSC
+    struct TSCCalibration {
+        uint64_t ticksAtStart;
+        uint64_t nanosecondsAtStart;
+        // 32.32 fixed point
+        uint64_t nanosecondsPerTick;
+    };
+
+    static const TSCCalibration &tscCalibration () {
+        static const TSCCalibration calibration = calibrateTSC();
+        return calibration;
+    }
+
+    static TSCCalibration calibrateTSC () {
+        // Count the ticks over 10 ms. A longer interval would be more precise, but 10 ms already keep the error in
+        // the range of ten parts per million, far below the jitter of any MIDI connection
+        TSCCalibration c;
+        c.nanosecondsAtStart = readClock (CLOCK_MONOTONIC_RAW);
+        c.ticksAtStart = __rdtsc();
+
+        timespec interval = {0, 10000000};
+        nanosleep (&interval, NULL);
+
+        const uint64_t nanosecondsElapsed = readClock (CLOCK_MONOTONIC_RAW) - c.nanosecondsAtStart;
+        const uint64_t ticksElapsed = __rdtsc() - c.ticksAtStart;
+        c.nanosecondsPerTick = (nanosecondsElapsed << 32) / ticksElapsed;
+        return c;
+    }
+#endif
+};
+
+#endif /* MIDITimestamp_h */
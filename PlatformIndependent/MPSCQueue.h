@@ -0,0 +1,95 @@
+//
+//  MPSCQueue.h
+//
+//  Lock free ring buffer for any number of producer threads and one consumer thread
+//
+
+#ifndef MPSCQueue_h
+#define MPSCQueue_h
+
+#include <stdint.h>
+#include <atomic>
+#include "CacheLineAligned.h"
+
+/**
+ * A fixed size ring buffer that many threads can push to at the same time while one thread pops from it. This is
+ * the bounded queue by Dmitry Vyukov: each slot carries a sequence number that tells whether it is free for the
+ * producer that claimed its position or holds an element ready for the consumer. Producers claim a position with
+ * a single compare and swap and never wait for each other while copying their element, elements leave the queue
+ * in the order their positions were claimed, so the order of each single producer is kept. The capacity has to be
+ * a power of two.
+ */
+template <typename Element, uint32_t capacity>
+class MPSCQueue : public CacheLineAligned {
+
+    static_assert ((capacity != 0) && ((capacity & (capacity - 1)) == 0), "The capacity must be a power of two");
+
+public:
+
+    MPSCQueue () : enqueuePosition (0), dequeuePosition (0) {
+        for (uint32_t i = 0; i < capacity; i++)
+            slots[i].sequence.store (i, std::memory_order_relaxed);
+    }
+
+    /** Producer side, may be called from any thread. Returns false if the queue is full */
+    bool push (const Element &element) {
+        uint32_t position = enqueuePosition.load (std::memory_order_relaxed);
+        Slot *slot;
+
+        while (true) {
+            slot = &slots[position & mask];
+            const int32_t difference = (int32_t)(slot->sequence.load (std::memory_order_acquire) - position);
+
+            if (difference == 0) {
+                // the slot is free, try to claim its position
+                if (enqueuePosition.compare_exchange_weak (position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0) {
+                // the slot still holds the element of the previous round, the consumer didn't get there yet
+                return false;
+            }
+            else {
+                // another producer claimed this position in the meantime
+                position = enqueuePosition.load (std::memory_order_relaxed);
+            }
+        }
+
+        slot->element = element;
+        slot->sequence.store (position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer side. Returns false if the queue is empty or the next element is not completely written yet */
+    bool pop (Element &element) {
+        Slot &slot = slots[dequeuePosition & mask];
+        if (slot.sequence.load (std::memory_order_acquire) != dequeuePosition + 1)
+            return false;
+
+        element = slot.element;
+        slot.sequence.store (dequeuePosition + capacity, std::memory_order_release);
+        dequeuePosition++;
+        return true;
+    }
+
+    /** Consumer side. True if there is no element ready to be popped */
+    bool empty () const {
+        return slots[dequeuePosition & mask].sequence.load (std::memory_order_acquire) != dequeuePosition + 1;
+    }
+
+private:
+
+    static const uint32_t mask = capacity - 1;
+
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        Element element;
+    };
+
+    // Producers and the consumer work on separate cache lines
+    alignas (64) std::atomic<uint32_t> enqueuePosition;
+    alignas (64) uint32_t dequeuePosition;
+    alignas (64) Slot slots[capacity];
+};
+
+#endif /* MPSCQueue_h */
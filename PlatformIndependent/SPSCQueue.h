@@ -0,0 +1,150 @@
+//
+//  SPSCQueue.h
+//
+//  Lock free ring buffer for exactly one producer and one consumer thread
+//
+
+#ifndef SPSCQueue_h
+#define SPSCQueue_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include "CacheLineAligned.h"
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+#include <atomic>
+#endif
+
+/**
+ * A fixed size ring buffer that one thread pushes to and another thread pops from without any locks or system
+ * calls, e.g. to hand over received MIDI events from the receive thread to an audio thread. The capacity has to
+ * be a power of two.
+ *
+ * Both indices count up forever and are only masked when the buffer is accessed, so a full and an empty queue
+ * can be told apart without wasting a slot. Each side keeps a private copy of the other side's index and only
+ * reloads the shared one when the copy says the queue is full or empty, which keeps the cache line of the other
+ * side untouched most of the time.
+ *
+ * On single threaded targets like Arduino both sides are called from the same thread and the indices are plain
+ * integers.
+ */
+template <typename Element, uint32_t capacity>
+class SPSCQueue : public CacheLineAligned {
+
+#ifdef SIMPLE_MIDI_PRE_C++11
+    // Without static_assert, the size of this array turns negative and stops the build if the check fails
+    typedef char capacityMustBeAPowerOfTwo[((capacity != 0) && ((capacity & (capacity - 1)) == 0)) ? 1 : -1];
+#else
+    static_assert ((capacity != 0) && ((capacity & (capacity - 1)) == 0), "The capacity must be a power of two");
+#endif
+
+public:
+
+    SPSCQueue () : writeIndex (0), readIndexCache (0), readIndex (0), writeIndexCache (0) {}
+
+    /** Producer side. Returns false if the queue is full, in this case the element is not added */
+    bool push (const Element &element) {
+        const uint32_t write = load (writeIndex, false);
+
+        if (write - readIndexCache == capacity) {
+            readIndexCache = load (readIndex, true);
+            if (write - readIndexCache == capacity)
+                return false;
+        }
+
+        elements[write & mask] = element;
+        store (writeIndex, write + 1);
+        return true;
+    }
+
+    /** Producer side. Adds as many of the elements passed as fit into the queue and returns the number added */
+    size_t push (const Element *source, size_t numElements) {
+        const uint32_t write = load (writeIndex, false);
+
+        if (capacity - (write - readIndexCache) < numElements)
+            readIndexCache = load (readIndex, true);
+
+        const uint32_t numFree = capacity - (write - readIndexCache);
+        if (numElements > numFree)
+            numElements = numFree;
+
+        for (uint32_t i = 0; i < numElements; i++)
+            elements[(write + i) & mask] = source[i];
+
+        store (writeIndex, write + (uint32_t)numElements);
+        return numElements;
+    }
+
+    /** Consumer side. Returns false if the queue is empty */
+    bool pop (Element &element) {
+        return pop (&element, 1) == 1;
+    }
+
+    /** Consumer side. Copies up to maxElements elements to the destination and returns the number copied */
+    size_t pop (Element *destination, size_t maxElements) {
+        const uint32_t read = load (readIndex, false);
+
+        if (writeIndexCache - read < maxElements)
+            writeIndexCache = load (writeIndex, true);
+
+        uint32_t numElements = writeIndexCache - read;
+        if (numElements > maxElements)
+            numElements = (uint32_t)maxElements;
+
+        for (uint32_t i = 0; i < numElements; i++)
+            destination[i] = elements[(read + i) & mask];
+
+        store (readIndex, read + numElements);
+        return numElements;
+    }
+
+    /** Number of elements in the queue. Only a snapshot if the other side is active at the same time */
+    uint32_t size () const {
+        return load (writeIndex, true) - load (readIndex, true);
+    }
+
+    static uint32_t getCapacity () {
+        return capacity;
+    }
+
+private:
+
+    static const uint32_t mask = capacity - 1;
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    typedef std::atomic<uint32_t> Index;
+
+    static uint32_t load (const Index &index, bool fromOtherThread) {
+        return index.load (fromOtherThread ? std::memory_order_acquire : std::memory_order_relaxed);
+    }
+
+    static void store (Index &index, uint32_t value) {
+        index.store (value, std::memory_order_release);
+    }
+
+    // The producer and the consumer state live on separate cache lines so that they don't invalidate each other
+    alignas (64) Index writeIndex;
+    uint32_t readIndexCache;
+    alignas (64) Index readIndex;
+    uint32_t writeIndexCache;
+    alignas (64) Element elements[capacity];
+#else
+    typedef volatile uint32_t Index;
+
+    static uint32_t load (const Index &index, bool fromOtherThread) {
+        return index;
+    }
+
+    static void store (Index &index, uint32_t value) {
+        index = value;
+    }
+
+    Index writeIndex;
+    uint32_t readIndexCache;
+    Index readIndex;
+    uint32_t writeIndexCache;
+    Element elements[capacity];
+#endif
+};
+
+#endif /* SPSCQueue_h */
@@ -0,0 +1,297 @@
+//
+//  StaticMIDI.h
+//
+//  Compile time alternative to the virtual SimpleMIDI interface
+//
+
+#ifndef StaticMIDI_h
+#define StaticMIDI_h
+
+#include "MIDIDefinitions.h"
+#include "MIDIEncoder.h"
+#include "MIDIParser.h"
+#include "MIDITimestamp.h"
+
+/**
+ * A MIDI connection that dispatches incoming messages to its handlers at compile time instead of through virtual
+ * functions. Derive your class from it, passing the class itself as first template argument, and define the
+ * receivedXYZ() handlers you are interested in. They are called directly by the parser and can be inlined, all
+ * handlers you don't define resolve to the empty default implementations here and compile away completely.
+ *
+ *      class MySynth : public StaticMIDI<MySynth, MyTransport> {
+ *      public:
+ *          MySynth (MyTransport &t) : StaticMIDI<MySynth, MyTransport> (t) {}
+ *
+ *          void receivedNote (uint8_t note, uint8_t velocity, bool onOff) { ... }
+ *      };
+ *
+ * The Transport is any class with a member function write (const uint8_t *bytes, size_t length) that is used for
+ * all outgoing messages. Incoming bytes are passed to receive(), e.g. right after they were read from a serial port.
+ * The parser and the encoders are the same that SimpleMIDI uses, so both behave exactly the same way.
+ *
+ * SysEx messages are only available through the receivedSysExBegin(), receivedSysExChunk() and receivedSysExEnd()
+ * handlers, no buffer is reserved to collect them.
+ */
+template <typename Derived, typename Transport>
+class StaticMIDI : public MIDIDefinitions {
+public:
+
+    StaticMIDI (Transport &transportToUse) : transport (transportToUse), lastChannel (Channel1), receiveTimestamp (0), sendChannel (Channel1), receiveChannel (ChannelAny), receiveChannelMask (0xFFFF), receiveMessageMask (AllMessages) {}
+
+    /** Parses the bytes received and invokes the handlers of the derived class. The messages are timestamped now */
+    void receive (const uint8_t *bytes, size_t numBytes) {
+        receive (bytes, numBytes, MIDITimestamp::now());
+    }
+
+    /** Parses the bytes received with a timestamp in nanoseconds taken by the caller, e.g. by the driver */
+    void receive (const uint8_t *bytes, size_t numBytes, uint64_t timestamp) {
+        receiveTimestamp = timestamp;
+        receiveParser.feed (static_cast<Derived &> (*this), bytes, numBytes);
+    }
+
+    // send MIDI Messages
+    RetValue sendNote (uint8_t note, uint8_t velocity, bool onOff) {
+        return sendNote (note, velocity, onOff, sendChannel);
+    }
+
+    RetValue sendNote (uint8_t note, uint8_t velocity, bool onOff, Channel channel) {
+        SIMPLE_MIDI_CHECK_RANGE ((note >> 7) != 0, FirstArgumentOutOfRange);
+        SIMPLE_MIDI_CHECK_RANGE ((velocity >> 7) != 0, SecondArgumentOutOfRange);
+
+        uint8_t dataToSend[3];
+        if (onOff == NoteOn)
+            encodeNoteOn (channel, note, velocity, dataToSend);
+        else
+            encodeNoteOff (channel, note, velocity, dataToSend);
+
+        transport.write (dataToSend, 3);
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+
+    RetValue sendAftertouchEvent (uint8_t note, uint8_t velocity) {
+        return sendAftertouchEvent (note, velocity, sendChannel);
+    }
+
+    RetValue sendAftertouchEvent (uint8_t note, uint8_t velocity, Channel channel) {
+        SIMPLE_MIDI_CHECK_RANGE ((velocity >> 7) != 0, SecondArgumentOutOfRange);
+
+        uint8_t dataToSend[3];
+
+        if (note == MonophonicAftertouch) {
+            transport.write (dataToSend, encodeMonophonicAftertouch (channel, velocity, dataToSend));
+            return SIMPLE_MIDI_SEND_RESULT;
+        }
+
+        SIMPLE_MIDI_CHECK_RANGE ((note >> 7) != 0, FirstArgumentOutOfRange);
+        transport.write (dataToSend, encodePolyphonicAftertouch (channel, note, velocity, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+
+    RetValue sendControlChange (uint8_t control, uint8_t value) {
+        return sendControlChange (control, value, sendChannel);
+    }
+
+    RetValue sendControlChange (uint8_t control, uint8_t value, Channel channel) {
+        SIMPLE_MIDI_CHECK_RANGE ((control >> 7) != 0, FirstArgumentOutOfRange);
+        SIMPLE_MIDI_CHECK_RANGE ((value >> 7) != 0, SecondArgumentOutOfRange);
+
+        uint8_t dataToSend[3];
+        transport.write (dataToSend, encodeControlChange (channel, control, value, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+
+    RetValue sendProgramChange (uint8_t program) {
+        return sendProgramChange (program, sendChannel);
+    }
+
+    RetValue sendProgramChange (uint8_t program, Channel channel) {
+        SIMPLE_MIDI_CHECK_RANGE ((program >> 7) != 0, FirstArgumentOutOfRange);
+
+        uint8_t dataToSend[2];
+        transport.write (dataToSend, encodeProgramChange (channel, program, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+
+    RetValue sendPitchBend (int16_t pitch) {
+        return sendPitchBend (pitch, sendChannel);
+    }
+
+    RetValue sendPitchBend (int16_t pitch, Channel channel) {
+        SIMPLE_MIDI_CHECK_RANGE ((pitch < -8192) || (pitch > 8191), FirstArgumentOutOfRange);
+
+        uint8_t dataToSend[3];
+        transport.write (dataToSend, encodePitchBend (channel, pitch, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+
+    // !! SysEx Messages must be framed by SYSEX_BEGIN and SYSEX_END
+    RetValue sendSysEx (const char *sysExBuffer, uint16_t length) {
+        if (sysExBuffer[0] != SysExBegin)
+            return MissingSysExStart;
+        if (sysExBuffer[length - 1] != SysExEnd)
+            return MissingSysExEnd;
+
+        transport.write ((const uint8_t *)sysExBuffer, length);
+        return Success;
+    }
+
+    RetValue sendMIDITimecodeQuarterFrame (uint8_t quarterFrame) {
+        SIMPLE_MIDI_CHECK_RANGE ((quarterFrame >> 7) != 0, FirstArgumentOutOfRange);
+
+        uint8_t dataToSend[2];
+        transport.write (dataToSend, encodeMIDITimecodeQuarterFrame (quarterFrame, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+
+    RetValue sendMIDISongPositionPointer (uint16_t positionInBeats) {
+        SIMPLE_MIDI_CHECK_RANGE ((positionInBeats >> 14) != 0, FirstArgumentOutOfRange);
+
+        uint8_t dataToSend[3];
+        transport.write (dataToSend, encodeSongPositionPointer (positionInBeats, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+
+    RetValue sendSongSelect (uint8_t songToSelect) {
+        SIMPLE_MIDI_CHECK_RANGE ((songToSelect >> 7) != 0, FirstArgumentOutOfRange);
+
+        uint8_t dataToSend[2];
+        transport.write (dataToSend, encodeSongSelect (songToSelect, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+
+    void sendTuneRequest()   { sendSingleByte (TuneRequest); }
+    void sendMIDIClockTick() { sendSingleByte (ClockTickCmd); }
+    void sendMIDIStart()     { sendSingleByte (StartCmd); }
+    void sendMIDIStop()      { sendSingleByte (StopCmd); }
+    void sendMIDIContinue()  { sendSingleByte (ContinueCmd); }
+    void sendActiveSense()   { sendSingleByte (ActiveSense); }
+    void sendReset()         { sendSingleByte (MIDIReset); }
+
+    /** Sends a message that was encoded before, e.g. at compile time. @see MIDIMessage */
+    void send (const MIDIMessage &message) {
+        transport.write (message.bytes, message.length);
+    }
+
+    /** Sends out a raw buffer of bytes. The caller must gurantee that this is a valid MIDI command. */
+    void sendRawMIDIBuffer (const uint8_t *bytesToSend, size_t length) {
+        transport.write (bytesToSend, length);
+    }
+
+    /** @see SimpleMIDI::setSendChannel */
+    bool setSendChannel (Channel channel) {
+        if (channel > Channel16)
+            return false;
+        sendChannel = channel;
+        return true;
+    }
+
+    Channel getSendChannel() {
+        return sendChannel;
+    }
+
+    /** @see SimpleMIDI::setReceiveChannel */
+    bool setReceiveChannel (Channel channel) {
+        if (channel > ChannelAny)
+            return false;
+        receiveChannel = channel;
+        if (channel != ChannelAny) {
+            lastChannel = channel;
+            receiveChannelMask = 1 << channel;
+        }
+        else {
+            receiveChannelMask = 0xFFFF;
+        }
+        return true;
+    }
+
+    /** @see SimpleMIDI::setReceiveChannelMask */
+    void setReceiveChannelMask (uint16_t channelMask) {
+        receiveChannelMask = channelMask;
+        if ((channelMask != 0) && ((channelMask & (channelMask - 1)) == 0)) {
+            receiveChannel = (Channel)__builtin_ctz (channelMask);
+            lastChannel = receiveChannel;
+        }
+        else {
+            receiveChannel = ChannelAny;
+        }
+    }
+
+    uint16_t getReceiveChannelMask() {
+        return receiveChannelMask;
+    }
+
+    /** @see SimpleMIDI::setReceiveMessageMask */
+    void setReceiveMessageMask (uint32_t messageMask) {
+        receiveMessageMask = messageMask;
+    }
+
+    uint32_t getReceiveMessageMask() {
+        return receiveMessageMask;
+    }
+
+    Channel getReceiveChannel() {
+        return receiveChannel;
+    }
+
+    /** @see SimpleMIDI::getMostRecentSourceChannel */
+    Channel getMostRecentSourceChannel() {
+        return lastChannel;
+    }
+
+    /** @see SimpleMIDI::getMostRecentTimestamp */
+    uint64_t getMostRecentTimestamp() {
+        return receiveTimestamp;
+    }
+
+    // ----------- Default handlers, define the ones you need with the same signature in the derived class --------
+    // See SimpleMIDI for a description of each of them
+    void receivedNote (uint8_t note, uint8_t velocity, bool onOff) {}
+    void receivedAftertouch (uint8_t note, uint8_t velocity) {}
+    void receivedControlChange (uint8_t control, uint8_t value) {}
+    void receivedProgramChange (uint8_t program) {}
+    void receivedPitchBend (int16_t pitch) {}
+    void receivedSysExBegin() {}
+    void receivedSysExChunk (const uint8_t *data, size_t length) {}
+    void receivedSysExEnd (bool complete) {}
+    void receivedMIDITimecodeQuarterFrame (uint8_t quarterFrame) {}
+    void receivedMIDIClockTick() {}
+    void receivedSongSelect (uint8_t selectedSong) {}
+    void receivedMIDIStart() {}
+    void receivedMIDIStop() {}
+    void receivedMIDIContinue() {}
+    void receivedSongPositionPointer (uint16_t positionInBeats) {}
+    void receivedTuneRequest() {}
+    void receivedActiveSense() {}
+    void receivedMIDIReset() {}
+    void receivedUnknownCommand (uint8_t *dataBuffer, int numBytesAvailable) {}
+
+protected:
+    // The parser needs to know the receive channel and updates the most recent source channel
+    template <typename Receiver> friend class MIDIParser;
+
+    Transport &transport;
+    MIDIParser<Derived> receiveParser;
+
+    Channel lastChannel;
+    uint64_t receiveTimestamp;
+    Channel sendChannel;
+    Channel receiveChannel;
+    uint16_t receiveChannelMask;
+    uint32_t receiveMessageMask;
+
+    void sendSingleByte (uint8_t byte) {
+        transport.write (&byte, 1);
+    }
+
+    // StaticMIDI always dispatches to the handlers directly
+    bool queueReceivedEvent (uint8_t status, uint8_t data1, uint8_t data2) {
+        return false;
+    }
+
+    // Control changes are always passed on as they are
+    bool assembleControlChange (uint8_t control, uint8_t value) {
+        return false;
+    }
+};
+
+#endif /* StaticMIDI_h */
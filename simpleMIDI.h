@@ -12,121 +12,584 @@
 
 
 #include "ArchitectureSpecific/ArchitectureSpecific.h"
+#include "PlatformIndependent/MIDIDefinitions.h"
+#include "PlatformIndependent/MIDIEncoder.h"
+#include "PlatformIndependent/MIDIParser.h"
+#include "PlatformIndependent/MIDIRunningStatus.h"
+#include "PlatformIndependent/MIDIOutputThinner.h"
+#include "PlatformIndependent/MIDIParameterAssembler.h"
+#include "PlatformIndependent/MIDIEvent.h"
+#include "PlatformIndependent/MIDITimestamp.h"
+#include "PlatformIndependent/SPSCQueue.h"
+#include "PlatformIndependent/StaticMIDI.h"
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+#include "PlatformIndependent/MPSCQueue.h"
+#include "PlatformIndependent/MIDIThreadConfiguration.h"
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+#include <string.h>
+
+// Incoming SysEx messages are collected in a buffer of this size before they are passed to receivedSysEx(). Longer
+// messages are dropped and reported through droppedSysExBuffer(). To receive SysEx messages of any length, override
+// receivedSysExBegin(), receivedSysExChunk() and receivedSysExEnd() instead.
+#ifndef SIMPLE_MIDI_SYSEX_BUFFER_SIZE
+#ifdef SIMPLE_MIDI_MULTITHREADED
+#define SIMPLE_MIDI_SYSEX_BUFFER_SIZE 65535
+#else
+#define SIMPLE_MIDI_SYSEX_BUFFER_SIZE 256
+#endif
+#endif
+
+// Number of received events that can wait to be polled, must be a power of two. @see SimpleMIDI::poll
+#ifndef SIMPLE_MIDI_EVENT_QUEUE_SIZE
+#ifdef SIMPLE_MIDI_MULTITHREADED
+#define SIMPLE_MIDI_EVENT_QUEUE_SIZE 1024
+#else
+#define SIMPLE_MIDI_EVENT_QUEUE_SIZE 16
+#endif
+#endif
+
+// Size of the buffer that collects outgoing messages between beginBatch() and flush(). @see SimpleMIDI::beginBatch
+#ifndef SIMPLE_MIDI_TRANSMIT_BUFFER_SIZE
+#ifdef SIMPLE_MIDI_MULTITHREADED
+#define SIMPLE_MIDI_TRANSMIT_BUFFER_SIZE 512
+#else
+#define SIMPLE_MIDI_TRANSMIT_BUFFER_SIZE 32
+#endif
+#endif
+
+// Number of messages MIDIRealtimeSender can hold, must be a power of two. @see MIDIRealtimeSender
+#ifndef SIMPLE_MIDI_REALTIME_SEND_QUEUE_SIZE
+#define SIMPLE_MIDI_REALTIME_SEND_QUEUE_SIZE 1024
+#endif
+
+// Number of messages that can wait for the send thread, must be a power of two. @see SimpleMIDI::setThreadSafeSending
+#ifndef SIMPLE_MIDI_SEND_QUEUE_SIZE
+#define SIMPLE_MIDI_SEND_QUEUE_SIZE 4096
+#endif
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+class MIDIWirePacer;
+#endif
 
 // Abstract base class for all architecture specific implementations
-class SimpleMIDI {
+class SimpleMIDI : public MIDIDefinitions, public CacheLineAligned {
 public:
     
-    static const bool NoteOn = true;
-    static const bool NoteOff = false;
-    
-    //=========================================================================
-    // All possible MIDI commands, the standard describes
-    // 4 Bit commands
-    static const uint8_t NoteOffCmd =               0b1000; // 2 data Bytes
-    static const uint8_t NoteOnCmd =                0b1001; // 2 data Bytes
-    static const uint8_t PolyphonicAftertouchCmd =  0b1010; // 2 data Bytes
-    static const uint8_t ControlChangeCmd =         0b1011; // 2 data Bytes
-    static const uint8_t ProgrammChangeCmd =        0b1100; // 1 data Byte
-    static const uint8_t MonophonicAftertouchCmd =  0b1101; // 1 data Byte
-    static const uint8_t PitchBendCmd =             0b1110; // 2 data Bytes
-    // --> a command with a form of 0b110xxxxx will have only one data byte
-    // 8 Bit commands
-    static const char SysExBegin =               0b11110000; // x data Bytes
-    static const uint8_t MIDITimecodeQuarterFrame = 0b11110001; // 1 data Byte
-    static const uint8_t SongPositionPointerCmd =   0b11110010; // 2 data Bytes
-    static const uint8_t SongSelectCmd =            0b11110011; // 1 data Byte
-    //  0b11110100 undefined
-    //  0b11110101 undefined
-    static const uint8_t TuneRequest =              0b11110110; // 0 data Bytes
-    static const char SysExEnd =                 0b11110111; // 0 data Bytes
-    static const uint8_t ClockTickCmd =             0b11111000; // 0 data Bytes
-    //  0b11111001 undefined
-    static const uint8_t StartCmd =                 0b11111010; // 0 data Bytes
-    static const uint8_t ContinueCmd =              0b11111011; // 0 data Bytes
-    static const uint8_t StopCmd =                  0b11111100; // 0 data Bytes
-    //  0b11111101 undefined
-    static const uint8_t ActiveSense =              0b11111110; // 0 data Bytes
-    static const uint8_t MIDIReset =                0b11111111;
-    
-    
-    
-    enum Channel : uint8_t {
-        Channel1 = 0,
-        Channel2 = 1,
-        Channel3 = 2,
-        Channel4 = 3,
-        Channel5 = 4,
-        Channel6 = 5,
-        Channel7 = 6,
-        Channel8 = 7,
-        Channel9 = 8,
-        Channel10 = 9,
-        Channel11 = 10,
-        Channel12 = 11,
-        Channel13 = 12,
-        Channel14 = 13,
-        Channel15 = 14,
-        Channel16 = 15,
-        ChannelAny = 16
+    virtual ~SimpleMIDI() {
+        delete outputThinner;
+        delete parameterAssembler;
     };
     
+    // ----------- All messages are encoded here and passed to the architecture specific writeRawMIDIBytes ---------
     
-    // ----------- These member functions are implemented by the architecture specific implementations ------------
-    virtual ~SimpleMIDI() {};
+    // send MIDI Messages
+    virtual RetValue sendNote (uint8_t note, uint8_t velocity, bool onOff) {
+        return sendNote (note, velocity, onOff, sendChannel);
+    }
     
-    enum RetValue : int8_t {
-        NoErrorCheckingForSpeedReasons = 1,
-        Success = 0,
-        FirstArgumentOutOfRange = -1,
-        SecondArgumentOutOfRange = -2,
-        ThirdArgumentOutOfRange = -3,
-        FourthArgumentOutOfRange = -4,
-        MissingSysExStart = -5,
-        MissingSysExEnd = -6
-    };
+    virtual RetValue sendNote (uint8_t note, uint8_t velocity, bool onOff, Channel channel) {
+        //Check if values are 7Bit as the MIDI Standard requires
+        SIMPLE_MIDI_CHECK_RANGE ((note >> 7) != 0, FirstArgumentOutOfRange);
+        SIMPLE_MIDI_CHECK_RANGE ((velocity >> 7) != 0, SecondArgumentOutOfRange);
+        
+        uint8_t dataToSend[3];
+        if (onOff == NoteOn)
+            encodeNoteOn (channel, note, velocity, dataToSend);
+        else
+            encodeNoteOff (channel, note, velocity, dataToSend);
+        
+        sendRawMIDIBuffer (dataToSend, 3);
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+    
+    virtual RetValue sendAftertouchEvent (uint8_t note, uint8_t velocity) {
+        return sendAftertouchEvent (note, velocity, sendChannel);
+    }
+    
+    virtual RetValue sendAftertouchEvent (uint8_t note, uint8_t velocity, Channel channel) {
+        SIMPLE_MIDI_CHECK_RANGE ((velocity >> 7) != 0, SecondArgumentOutOfRange);
+        
+        uint8_t dataToSend[3];
+        
+        // check if it is a monophonic aftertouch
+        if (note == MonophonicAftertouch) {
+            sendRawMIDIBuffer (dataToSend, encodeMonophonicAftertouch (channel, velocity, dataToSend));
+            return SIMPLE_MIDI_SEND_RESULT;
+        }
+        
+        SIMPLE_MIDI_CHECK_RANGE ((note >> 7) != 0, FirstArgumentOutOfRange);
+        sendRawMIDIBuffer (dataToSend, encodePolyphonicAftertouch (channel, note, velocity, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+    
+    virtual RetValue sendControlChange (uint8_t control, uint8_t value) {
+        return sendControlChange (control, value, sendChannel);
+    }
+    
+    virtual RetValue sendControlChange (uint8_t control, uint8_t value, Channel channel) {
+        SIMPLE_MIDI_CHECK_RANGE ((control >> 7) != 0, FirstArgumentOutOfRange);
+        SIMPLE_MIDI_CHECK_RANGE ((value >> 7) != 0, SecondArgumentOutOfRange);
+
+        // selecting a parameter by hand makes the cached one invalid. There is no cache for invalid channels
+        if ((control >= 98) && (control <= 101) && (channel <= Channel16)) {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+            std::lock_guard<std::mutex> lock (parameterSelectionMutex);
+#endif
+            selectedParameter[channel] = NoParameterSelected;
+        }
+        
+        uint8_t dataToSend[3];
+        sendRawMIDIBuffer (dataToSend, encodeControlChange (channel, control, value, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+    
+    virtual RetValue sendProgramChange (uint8_t program) {
+        return sendProgramChange (program, sendChannel);
+    }
+    
+    virtual RetValue sendProgramChange (uint8_t program, Channel channel) {
+        SIMPLE_MIDI_CHECK_RANGE ((program >> 7) != 0, FirstArgumentOutOfRange);
+        
+        uint8_t dataToSend[2];
+        sendRawMIDIBuffer (dataToSend, encodeProgramChange (channel, program, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+    
+    /**
+     * Sends a pitch bend in the range from -8192 to 8191 with 0 meaning no pitch bend
+     */
+    virtual RetValue sendPitchBend (int16_t pitch) {
+        return sendPitchBend (pitch, sendChannel);
+    }
+    
+    virtual RetValue sendPitchBend (int16_t pitch, Channel channel) {
+        SIMPLE_MIDI_CHECK_RANGE ((pitch < -8192) || (pitch > 8191), FirstArgumentOutOfRange);
+        
+        uint8_t dataToSend[3];
+        sendRawMIDIBuffer (dataToSend, encodePitchBend (channel, pitch, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
     
-    // send MIDI Messages
-    virtual RetValue sendNote (uint8_t note, uint8_t velocity, bool onOff) = 0;
-    virtual RetValue sendNote (uint8_t note, uint8_t velocity, bool onOff, Channel channel) = 0;
-    virtual RetValue sendAftertouchEvent (uint8_t note, uint8_t velocity) = 0;
-    virtual RetValue sendAftertouchEvent (uint8_t note, uint8_t velocity, Channel channel) = 0;
-    virtual RetValue sendControlChange (uint8_t control, uint8_t value) = 0;
-    virtual RetValue sendControlChange (uint8_t control, uint8_t value, Channel channel) = 0;
-    virtual RetValue sendProgramChange (uint8_t program) = 0;
-    virtual RetValue sendProgramChange (uint8_t program, Channel channel) = 0;
-    virtual RetValue sendPitchBend (int16_t pitch) = 0;
     // !! SysEx Messages must be framed by SYSEX_BEGIN and SYSEX_END
-    virtual RetValue sendSysEx (const char *sysExBuffer, uint16_t length) = 0;
-    virtual RetValue sendMIDITimecodeQuarterFrame (uint8_t quarterFrame) = 0;
-    virtual RetValue sendMIDISongPositionPointer (uint16_t positionInBeats) = 0;
-    virtual RetValue sendSongSelect (uint8_t songToSelect) = 0;
-    virtual void sendTuneRequest() = 0;
-    virtual void sendMIDIClockTick() = 0;
-    virtual void sendMIDIStart() = 0;
-    virtual void sendMIDIStop() = 0;
-    virtual void sendMIDIContinue() = 0;
-    virtual void sendActiveSense() = 0;
-    virtual void sendReset() = 0;
+    virtual RetValue sendSysEx (const char *sysExBuffer, uint16_t length) {
+        if (sysExBuffer[0] != SysExBegin)
+            return MissingSysExStart;
+        if (sysExBuffer[length - 1] != SysExEnd)
+            return MissingSysExEnd;
+        
+        sendRawMIDIBuffer ((const uint8_t *)sysExBuffer, length);
+        return Success;
+    }
+    
+    virtual RetValue sendMIDITimecodeQuarterFrame (uint8_t quarterFrame) {
+        SIMPLE_MIDI_CHECK_RANGE ((quarterFrame >> 7) != 0, FirstArgumentOutOfRange);
+        
+        uint8_t dataToSend[2];
+        sendRawMIDIBuffer (dataToSend, encodeMIDITimecodeQuarterFrame (quarterFrame, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+    
+    virtual RetValue sendMIDISongPositionPointer (uint16_t positionInBeats) {
+        // positionInBeats has to be a 14 Bit int
+        SIMPLE_MIDI_CHECK_RANGE ((positionInBeats >> 14) != 0, FirstArgumentOutOfRange);
+        
+        uint8_t dataToSend[3];
+        sendRawMIDIBuffer (dataToSend, encodeSongPositionPointer (positionInBeats, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+    
+    virtual RetValue sendSongSelect (uint8_t songToSelect) {
+        SIMPLE_MIDI_CHECK_RANGE ((songToSelect >> 7) != 0, FirstArgumentOutOfRange);
+        
+        uint8_t dataToSend[2];
+        sendRawMIDIBuffer (dataToSend, encodeSongSelect (songToSelect, dataToSend));
+        return SIMPLE_MIDI_SEND_RESULT;
+    }
+    
+    virtual void sendTuneRequest() {
+        sendSingleByte (TuneRequest);
+    }
+    
+    virtual void sendMIDIClockTick() {
+        sendSingleByte (ClockTickCmd);
+    }
+    
+    virtual void sendMIDIStart() {
+        sendSingleByte (StartCmd);
+    }
+    
+    virtual void sendMIDIStop() {
+        sendSingleByte (StopCmd);
+    }
+    
+    virtual void sendMIDIContinue() {
+        sendSingleByte (ContinueCmd);
+    }
+    
+    virtual void sendActiveSense() {
+        sendSingleByte (ActiveSense);
+    }
+    
+    virtual void sendReset() {
+        sendSingleByte (MIDIReset);
+        invalidateParameterSelection();
+    }
+
+    /**
+     * Sends a message that was encoded before, e.g. at compile time.
+     *
+     * @see MIDIMessage
+     */
+    void send (const MIDIMessage &message) {
+        sendRawMIDIBuffer (message.bytes, message.length);
+    }
 
     /**
      * Sends out a raw buffer of bytes over the MIDI output. The caller must gurantee that this is a valid
-     * MIDI command.
+     * MIDI command. All send functions pass their messages through this function.
+     */
+    void sendRawMIDIBuffer (const uint8_t *bytesToSend, int length) {
+        if (isOutputThinningEnabled() && !passesOutputThinning (bytesToSend, length))
+            return;
+
+        sendToOutput (bytesToSend, length);
+    }
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    /**
+     * Makes all send functions safe to be called from any number of threads at the same time, e.g. from the UI, an
+     * automation thread and a MIDIClockGenerator. Each message is pushed as a whole to a lock free multi producer
+     * queue and a single send thread writes them to the device, collecting all messages it finds into one batch.
+     * Messages sent by the same thread keep their order. If the queue is full, the sending thread yields until
+     * there is room again, so no message is lost.
+     *
+     * While thread safe sending is enabled, beginBatch() and flush() have no effect, the send thread batches on its
+     * own. Don't switch it on or off while other threads are sending. Disabling it sends everything still queued.
+     * A MIDIWirePacer attached to the connection replaces the send thread, it is thread safe on its own.
+     */
+    void setThreadSafeSending (bool enabled) {
+        if (enabled == (sendQueue != nullptr))
+            return;
+
+        if (enabled) {
+            flush();
+            sendThreadShouldExit = false;
+            sendQueue = new SendQueue;
+            sendThread = std::thread (&SimpleMIDI::sendThreadWork, this);
+            return;
+        }
+
+        sendThreadShouldExit = true;
+        wakeUpSendThread();
+        sendThread.join();
+        delete sendQueue;
+        sendQueue = nullptr;
+    }
+
+    bool isThreadSafeSendingEnabled() {
+        return sendQueue != nullptr;
+    }
+#endif
+
+    /**
+     * Enables or disables running status for all outgoing messages. With running status enabled, a channel
+     * message that has the same status byte (command and channel) as the previous one is sent without it,
+     * e.g. a dense stream of notes or controller changes on the same channel will only need two instead of
+     * three bytes per message. This is disabled by default. It only makes sense for byte stream connections
+     * like a serial port, CoreMIDI expects complete messages and therefore doesn't support it.
+     * @param enabled           True to leave out repeated status bytes
+     * @param refreshInterval   Number of status bytes that are left out in a row before it is sent again anyway,
+     *                          so that receivers connected in the middle of a run can sync. 0 means never
+     * @return  false if running status should be enabled but the connection doesn't support it, true otherwise
+     */
+    bool setRunningStatus (bool enabled, uint16_t refreshInterval = 0) {
+        if (enabled && !supportsRunningStatus)
+            return false;
+
+        runningStatusEncoder.setEnabled (enabled, refreshInterval);
+        return true;
+    }
+
+    /**
+     * Enables or disables thinning of outgoing control changes, pitch bends and channel pressure messages. Faders
+     * and automation tend to send the same controller thousands of times per second, often with an unchanged
+     * value, which floods slow links and receivers. With thinning enabled, a message that carries the value that
+     * was last sent for its controller and channel is dropped. If a minimum interval is set, each controller sends
+     * at most one message per interval and only the latest value of all that arrive within the interval is sent
+     * at its end. (N)RPN related controllers and channel mode messages are never thinned.
+     *
+     * In multithreaded builds a thread sends the latest values when their interval is over. As it sends at the
+     * same time as the application, enabling thinning with an interval also enables thread safe sending, unless a
+     * MIDIWirePacer is attached. On Arduino, call sendDueThinnedMessages() frequently, e.g. in loop().
+     *
+     * Other threads may keep sending while thinning is switched, the thinner is swapped under the lock the send
+     * path takes. Don't call this from several threads at the same time. Switching on thread safe sending follows
+     * the rules of setThreadSafeSending() though, so set up an interval before other threads start sending.
+     *
+     * @param enabled                   True to drop redundant messages
+     * @param minIntervalMicroseconds   Minimum time between two messages of the same controller, 0 only drops
+     *                                  repeated values
+     * @return  false if the thinner couldn't be allocated, e.g. on a microcontroller that is short of RAM.
+     *          Thinning is disabled then
+     *
+     * @see MIDIOutputThinner
+     */
+    bool setOutputThinning (bool enabled, uint32_t minIntervalMicroseconds = 0) {
+        if (isOutputThinningEnabled()) {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+            stopThinningThread();
+            std::unique_lock<std::mutex> lock (thinningMutex);
+#endif
+            // send the latest values still waiting for their interval to end, they must not get lost
+            outputThinner->setMinInterval (0);
+#ifdef SIMPLE_MIDI_MULTITHREADED
+            lock.unlock();
+#endif
+            sendDueThinnedMessages();
+        }
+
+        if (!enabled) {
+            MIDIOutputThinner *oldThinner;
+            {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+                std::lock_guard<std::mutex> lock (thinningMutex);
+                outputThinningEnabled.store (false, std::memory_order_relaxed);
+#endif
+                oldThinner = outputThinner;
+                outputThinner = NULL;
+            }
+            delete oldThinner;
+            return true;
+        }
+
+        if (!isOutputThinningEnabled()) {
+            MIDIOutputThinner *newThinner = new MIDIOutputThinner (minIntervalMicroseconds);
+            if (newThinner == NULL)
+                return false;
+#ifdef SIMPLE_MIDI_MULTITHREADED
+            std::lock_guard<std::mutex> lock (thinningMutex);
+            outputThinningEnabled.store (true, std::memory_order_relaxed);
+#endif
+            outputThinner = newThinner;
+        }
+        else {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+            std::lock_guard<std::mutex> lock (thinningMutex);
+#endif
+            outputThinner->setMinInterval (minIntervalMicroseconds);
+        }
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        if (minIntervalMicroseconds > 0) {
+            if (wirePacer.load() == nullptr)
+                setThreadSafeSending (true);
+            thinningThreadShouldExit = false;
+            thinningThread = std::thread (&SimpleMIDI::thinningThreadWork, this);
+        }
+#endif
+        return true;
+    }
+
+    bool isOutputThinningEnabled() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        return outputThinningEnabled.load (std::memory_order_relaxed);
+#else
+        return outputThinner != NULL;
+#endif
+    }
+
+    /**
+     * Forgets the last value sent for all controllers, so that the next value of each of them is sent in any case.
+     * Call this if the receiver might have lost its state, e.g. after it was reconnected.
+     */
+    void resetOutputThinning() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        std::lock_guard<std::mutex> lock (thinningMutex);
+#endif
+        if (outputThinner != NULL)
+            outputThinner->reset();
+    }
+
+    /**
+     * Sends the latest value of every controller whose thinning interval is over. Only needed on Arduino, where
+     * there is no thread to do this. Without calling it, a controller only sends its final value when any message
+     * is sent after the interval is over.
+     */
+    void sendDueThinnedMessages() {
+        uint8_t message[3];
+        while (true) {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+            std::unique_lock<std::mutex> lock (thinningMutex);
+#endif
+            if (outputThinner == NULL)
+                return;
+            const int length = outputThinner->popDueMessage (message, thinningTime());
+            if (length == 0)
+                return;
+#ifdef SIMPLE_MIDI_MULTITHREADED
+            lock.unlock();
+#endif
+            sendToOutput (message, length);
+        }
+    }
+
+    typedef MIDIParameterAssembler<SimpleMIDI> ParameterAssembler;
+
+    /**
+     * Enables combining the control changes that make up NRPN, RPN and 14 bit controller messages. Their values
+     * are passed to receivedNRPN(), receivedRPN() and receivedHiResControlChange() instead of receivedControlChange().
+     * All other control changes and those that can't be assigned to a parameter are still passed to
+     * receivedControlChange(). Messages stored for polling are never combined. Disabled by default.
+     *
+     * As the MSB of a value may come without an LSB, it can either be passed on right away and once more when
+     * the LSB follows (ParameterAssembler::EmitOnMSB), or wait for the LSB up to a timeout, after which it is passed
+     * on alone (ParameterAssembler::WaitForLSB).
+     *
+     * This may be called while messages are received, the assembler is swapped under a lock that the receive path
+     * takes as well. Parameters selected and MSBs received before are forgotten. Don't call it from the
+     * receivedNRPN(), receivedRPN() or receivedHiResControlChange() callbacks, they are invoked under that lock.
+     *
+     * @param assembleParameterNumbers      True to combine NRPN and RPN messages
+     * @param assembleHiResControlChanges   True to combine controllers 0 - 31 with controllers 32 - 63
+     * @return  false if the assembler couldn't be allocated, assembly is disabled then
+     *
+     * @see MIDIParameterAssembler
+     */
+    bool setParameterAssembly (bool assembleParameterNumbers, bool assembleHiResControlChanges,
+                               ParameterAssembler::Mode mode = ParameterAssembler::EmitOnMSB,
+                               uint32_t lsbTimeoutMicroseconds = 10000) {
+        ParameterAssembler *newAssembler = NULL;
+        if (assembleParameterNumbers || assembleHiResControlChanges) {
+            newAssembler = new ParameterAssembler (assembleParameterNumbers, assembleHiResControlChanges);
+            if (newAssembler != NULL)
+                newAssembler->setMode (mode, lsbTimeoutMicroseconds);
+        }
+
+        ParameterAssembler *oldAssembler;
+        {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+            std::lock_guard<std::mutex> lock (parameterAssemblyMutex);
+            parameterAssemblyEnabled.store (newAssembler != NULL, std::memory_order_relaxed);
+#endif
+            oldAssembler = parameterAssembler;
+            parameterAssembler = newAssembler;
+        }
+        delete oldAssembler;
+
+        return (newAssembler != NULL) || (!assembleParameterNumbers && !assembleHiResControlChanges);
+    }
+
+    bool isParameterAssemblyEnabled() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        return parameterAssemblyEnabled.load (std::memory_order_relaxed);
+#else
+        return parameterAssembler != NULL;
+#endif
+    }
+
+    /** Returns the number of messages dropped by the output thinning because their value was sent before */
+    uint32_t getNumDuplicatesSuppressed() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        std::lock_guard<std::mutex> lock (thinningMutex);
+#endif
+        return (outputThinner != NULL) ? outputThinner->getNumDuplicatesSuppressed() : 0;
+    }
+
+    /** Returns the number of messages dropped by the output thinning because a newer value replaced them */
+    uint32_t getNumRateLimitedSuppressed() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        std::lock_guard<std::mutex> lock (thinningMutex);
+#endif
+        return (outputThinner != NULL) ? outputThinner->getNumRateLimitedSuppressed() : 0;
+    }
+
+    /**
+     * Starts collecting all outgoing messages in a transmit buffer instead of writing each of them on its own. The
+     * buffer is written with a single call to the driver by flush(), so a patch recall of 128 control changes or
+     * a chord costs one system call instead of one per message. Call flush() when done.
+     *
+     * Messages are never split between two writes. The buffer is written earlier if the next message doesn't fit
+     * in anymore or one of the limits set with setBatchLimits() is reached.
+     */
+    void beginBatch() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        if ((sendQueue != nullptr) || (wirePacer.load() != nullptr))
+            return;
+#endif
+        batchOpen = true;
+    }
+
+    /** Writes everything collected since beginBatch() and sends all following messages right away again */
+    void flush() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        if ((sendQueue != nullptr) || (wirePacer.load() != nullptr))
+            return;
+#endif
+        batchOpen = false;
+        flushTransmitBuffer();
+    }
+
+    /**
+     * Sets the limits that flush a batch automatically before flush() is called.
+     * @param maxBytes              The collected bytes are written as soon as there are this many of them. Clipped
+     *                              to SIMPLE_MIDI_TRANSMIT_BUFFER_SIZE, which is also the default
+     * @param maxDelayMicroseconds  The collected bytes are written if the oldest of them waits for this long. This is
+     *                              checked whenever a message is sent, 0 (the default) disables the check
+     */
+    void setBatchLimits (uint16_t maxBytes, uint32_t maxDelayMicroseconds = 0) {
+        flushTransmitBuffer();
+        batchMaxBytes = ((maxBytes > 0) && (maxBytes < SIMPLE_MIDI_TRANSMIT_BUFFER_SIZE)) ? maxBytes : SIMPLE_MIDI_TRANSMIT_BUFFER_SIZE;
+        batchMaxDelay = (uint64_t)maxDelayMicroseconds * 1000;
+    }
+
+    /**
+     * Collects all messages sent during its lifetime and flushes them when it goes out of scope:
+     *
+     *      {
+     *          SimpleMIDI::Batch batch (midi);
+     *          for (uint8_t cc = 0; cc < 128; cc++)
+     *              midi.sendControlChange (cc, patch[cc]);
+     *      }
      */
-    virtual void sendRawMIDIBuffer (uint8_t *bytesToSend, int length) = 0;
+    class Batch {
+    public:
+        Batch (SimpleMIDI &midiToBatch) : midi (midiToBatch) {
+            midi.beginBatch();
+        }
+
+        ~Batch() {
+            midi.flush();
+        }
+
+    private:
+        SimpleMIDI &midi;
+    };
     
 
     /**
      * Send an NRPN message with a high resolution 14 bit value. Parameter and value will be split
      * into MSB and LSB parts. Valid range for both parameter and value are 0 to 16383.
+     *
+     * The parameter number is only sent if it differs from the one last selected on the channel, so ramping a
+     * single parameter only costs the two data entry messages. @see setParameterNullReset
      */
     RetValue sendHiResNRPN (uint16_t parameter, uint16_t value) {
+        return sendHiResNRPN (parameter, value, sendChannel);
+    }
+
+    RetValue sendHiResNRPN (uint16_t parameter, uint16_t value, Channel channel) {
         if (parameter > 0b0011111111111111)
             return FirstArgumentOutOfRange;
         if (value > 0b0011111111111111)
             return SecondArgumentOutOfRange;
 
-        sendHiResNRPN (parameter >> 7, parameter & 0b01111111, value >> 7, value & 0b01111111);
+        sendParameter (false, parameter, value >> 7, value & 0b01111111, true, channel);
 
         return Success;
     }
@@ -137,10 +600,14 @@ public:
      * 14 Bit value with a range from 0 to 16383.
      */
     RetValue sendHiResNRPN (uint8_t parameterMSB, uint8_t parameterLSB, uint16_t value) {
+        return sendHiResNRPN (parameterMSB, parameterLSB, value, sendChannel);
+    }
+
+    RetValue sendHiResNRPN (uint8_t parameterMSB, uint8_t parameterLSB, uint16_t value, Channel channel) {
         if (value > 0b0011111111111111)
             return ThirdArgumentOutOfRange;
 
-        return sendHiResNRPN (parameterMSB, parameterLSB, value >> 7, value & 0b01111111);
+        return sendHiResNRPN (parameterMSB, parameterLSB, value >> 7, value & 0b01111111, channel);
     }
 
     /**
@@ -148,6 +615,10 @@ public:
      * MSB and LSB seperately with a range from 0 to 127 for each argument.
      */
     RetValue sendHiResNRPN (uint8_t parameterMSB, uint8_t parameterLSB, uint8_t valueMSB, uint8_t valueLSB) {
+        return sendHiResNRPN (parameterMSB, parameterLSB, valueMSB, valueLSB, sendChannel);
+    }
+
+    RetValue sendHiResNRPN (uint8_t parameterMSB, uint8_t parameterLSB, uint8_t valueMSB, uint8_t valueLSB, Channel channel) {
         if (parameterMSB > 0b01111111)
             return FirstArgumentOutOfRange;
         if (parameterLSB > 0b01111111)
@@ -157,10 +628,7 @@ public:
         if (valueLSB > 0b01111111)
             return FourthArgumentOutOfRange;
 
-        uint8_t sequence[12] = {ControlChangeCmd, 99, parameterMSB, ControlChangeCmd, 98, parameterLSB,
-                                ControlChangeCmd, 6, valueMSB, ControlChangeCmd, 38, valueLSB};
-
-        sendRawMIDIBuffer (sequence, 12);
+        sendParameter (false, (parameterMSB << 7) | parameterLSB, valueMSB, valueLSB, true, channel);
 
         return Success;
     }
@@ -170,15 +638,19 @@ public:
      * with a range from 0 - 16383 while the value is an 8 bit value with a range from 0 - 127.
      */
     RetValue sendLoResNRPN (uint16_t parameter, uint8_t value) {
+        return sendLoResNRPN (parameter, value, sendChannel);
+    }
+
+    RetValue sendLoResNRPN (uint16_t parameter, uint8_t value, Channel channel) {
         if (parameter > 0b0011111111111111)
             return FirstArgumentOutOfRange;
 
-        RetValue r = sendLoResNRPN (parameter >> 7, parameter & 0b01111111, value);
+        RetValue r = sendLoResNRPN (parameter >> 7, parameter & 0b01111111, value, channel);
 
         if (r == ThirdArgumentOutOfRange)
             return SecondArgumentOutOfRange;
 
-        return Success;
+        return r;
     }
 
     /**
@@ -186,6 +658,10 @@ public:
      * separately. The valid range for all three arguments is 0 - 127.
      */
     RetValue sendLoResNRPN (uint8_t parameterMSB, uint8_t parameterLSB, uint8_t value) {
+        return sendLoResNRPN (parameterMSB, parameterLSB, value, sendChannel);
+    }
+
+    RetValue sendLoResNRPN (uint8_t parameterMSB, uint8_t parameterLSB, uint8_t value, Channel channel) {
         if (parameterMSB > 0b01111111)
             return FirstArgumentOutOfRange;
         if (parameterLSB > 0b01111111)
@@ -193,40 +669,100 @@ public:
         if (value > 0b01111111)
             return ThirdArgumentOutOfRange;
 
-        uint8_t sequence[9] = {ControlChangeCmd, 99, parameterMSB, ControlChangeCmd, 98, parameterLSB,
-                               ControlChangeCmd, 6, value};
-
-        sendRawMIDIBuffer (sequence, 9);
+        sendParameter (false, (parameterMSB << 7) | parameterLSB, value, 0, false, channel);
 
         return Success;
     }
 
     /**
-     * Sets the channel all outgoing messages that use a channel (note, aftertouch, control change, program change
-     * and pitch bend) use if they are called without a channel argument.
-     * @return  true if the channel was inside the valid range, false otherwise
-     */
-    bool setSendChannel (Channel sendChannel) {
-        if (sendChannel > Channel16) {
-            return false;
-        }
-        this->sendChannel = sendChannel;
-        return true;
-    };
-    
-    /**
-     * Returns the channel that all outgoing messages are sent to if no channel is provided with the call.
+     * Send an RPN message like the pitch bend sensitivity (parameter 0) with a high resolution 14 bit value.
+     * Valid range for both parameter and value are 0 to 16383. Like with NRPNs, the parameter number is only
+     * sent if it differs from the one last selected on the channel.
      */
-    Channel getSendChannel() {
-        
-        return sendChannel;
+    RetValue sendHiResRPN (uint16_t parameter, uint16_t value) {
+        return sendHiResRPN (parameter, value, sendChannel);
     }
-    
-    
-    /**
-     * Sets the channel all incomming messages that use a channel (note, aftertouch, control change, program change
-     * and pitch bend) react to. If you set a particular receive channel here, messages from a different channel
-     * will simply be ignored and won't invoke any callback. If you want to react to messages from all channels
+
+    RetValue sendHiResRPN (uint16_t parameter, uint16_t value, Channel channel) {
+        if (parameter > 0b0011111111111111)
+            return FirstArgumentOutOfRange;
+        if (value > 0b0011111111111111)
+            return SecondArgumentOutOfRange;
+
+        sendParameter (true, parameter, value >> 7, value & 0b01111111, true, channel);
+
+        return Success;
+    }
+
+    /** Send an RPN message with a low resolution 7 bit value. The parameter ranges from 0 - 16383 */
+    RetValue sendLoResRPN (uint16_t parameter, uint8_t value) {
+        return sendLoResRPN (parameter, value, sendChannel);
+    }
+
+    RetValue sendLoResRPN (uint16_t parameter, uint8_t value, Channel channel) {
+        if (parameter > 0b0011111111111111)
+            return FirstArgumentOutOfRange;
+        if (value > 0b01111111)
+            return SecondArgumentOutOfRange;
+
+        sendParameter (true, parameter, value, 0, false, channel);
+
+        return Success;
+    }
+
+    /**
+     * If enabled, each (N)RPN message is followed by the RPN null parameter (127/127), so that stray data entry
+     * messages sent afterwards, e.g. by a controller mapped to CC 6, can't change the parameter any more. As the
+     * parameter has to be selected again for the next message, this disables the parameter caching. Disabled by
+     * default.
+     */
+    void setParameterNullReset (bool enabled) {
+        parameterNullReset = enabled;
+    }
+
+    bool isParameterNullResetEnabled() {
+        return parameterNullReset;
+    }
+
+    /**
+     * Forgets which (N)RPN parameter is selected on each channel, so that the next (N)RPN message sends its
+     * parameter number in any case. Call this whenever the receiver might have lost its state, e.g. after it was
+     * reconnected. This also happens when a reset is sent. Control changes sent with sendControlChange() that
+     * select a parameter are taken into account, raw buffers are not.
+     */
+    void invalidateParameterSelection() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        std::lock_guard<std::mutex> lock (parameterSelectionMutex);
+#endif
+        memset (selectedParameter, 0, sizeof (selectedParameter));
+    }
+
+    /**
+     * Sets the channel all outgoing messages that use a channel (note, aftertouch, control change, program change
+     * and pitch bend) use if they are called without a channel argument.
+     * @return  true if the channel was inside the valid range, false otherwise
+     */
+    bool setSendChannel (Channel sendChannel) {
+        if (sendChannel > Channel16) {
+            return false;
+        }
+        this->sendChannel = sendChannel;
+        return true;
+    };
+    
+    /**
+     * Returns the channel that all outgoing messages are sent to if no channel is provided with the call.
+     */
+    Channel getSendChannel() {
+        
+        return sendChannel;
+    }
+    
+    
+    /**
+     * Sets the channel all incomming messages that use a channel (note, aftertouch, control change, program change
+     * and pitch bend) react to. If you set a particular receive channel here, messages from a different channel
+     * will simply be ignored and won't invoke any callback. If you want to react to messages from all channels
      * set it to ChannelAny. This is also the default value. In this case a call to getMostRecentSourceChannel will
      * return the channel of the last message that came in.
      *
@@ -240,11 +776,52 @@ public:
             this->receiveChannel = receiveChannel;
             if (receiveChannel != ChannelAny) {
                 lastChannel = receiveChannel;
+                receiveChannelMask = 1 << receiveChannel;
+            }
+            else {
+                receiveChannelMask = 0xFFFF;
             }
             return true;
         }
         return false;
     };
+
+    /**
+     * Sets all channels that incomming channel messages are accepted from at once, bit 0 stands for Channel1 and bit
+     * 15 for Channel16. To listen to channel 1, 2 and 10 only, pass (1 << Channel1) | (1 << Channel2) | (1 << Channel10).
+     * The mask is checked as soon as the status byte arrives, so messages from other channels cost nearly nothing.
+     * getReceiveChannel() will return ChannelAny if more than one channel is set.
+     *
+     * @see setReceiveChannel
+     */
+    void setReceiveChannelMask (uint16_t channelMask) {
+        receiveChannelMask = channelMask;
+        if ((channelMask != 0) && ((channelMask & (channelMask - 1)) == 0)) {
+            receiveChannel = (Channel)__builtin_ctz (channelMask);
+            lastChannel = receiveChannel;
+        }
+        else {
+            receiveChannel = ChannelAny;
+        }
+    }
+
+    uint16_t getReceiveChannelMask() {
+        return receiveChannelMask;
+    }
+
+    /**
+     * Selects the types of messages that are received, combined from constants like NoteMessages | ControlChangeMessages.
+     * All other messages are dropped right after their status byte without invoking a callback or being queued for
+     * polling. On busy merged lines this saves the work for active sense and clock messages, which often make up most
+     * of the traffic. All messages are received by default.
+     */
+    void setReceiveMessageMask (uint32_t messageMask) {
+        receiveMessageMask = messageMask;
+    }
+
+    uint32_t getReceiveMessageMask() {
+        return receiveMessageMask;
+    }
     
     /**
      * Returns the channel that's currently used for receiving. In case of ChannelAny getMostRecentSourceChannel() could
@@ -268,7 +845,54 @@ public:
     Channel getMostRecentSourceChannel() {
         return lastChannel;
     }
+
+    /**
+     * Returns the time the message that is currently passed to a receivedXYZ() callback arrived at, in nanoseconds
+     * of the MIDITimestamp clock. The timestamp is taken as close to the I/O as the implementation allows: CoreMIDI
+     * provides it with each packet, the tty implementation takes it when read() returns and on Arduino it is taken
+     * when receive() finds new bytes. All messages that arrived with the same packet or read() share a timestamp.
+     *
+     * @see MIDITimestamp
+     */
+    uint64_t getMostRecentTimestamp() {
+        return receiveTimestamp;
+    }
     
+    /**
+     * Switches between receiving messages through the receivedXYZ() callbacks and polling them. With polling
+     * enabled, all messages except for SysEx are decoded into MIDIEvents and stored in a lock free queue instead of
+     * invoking a callback. The application collects them with poll() from a thread of its choice, e.g. once per
+     * audio block, so that there is neither a virtual call nor a handover between threads for each single message.
+     * SysEx messages and unknown commands are still passed to their callbacks. Disabled by default.
+     */
+    void setPollingEnabled (bool shouldPoll) {
+        pollingEnabled = shouldPoll;
+    }
+
+    bool isPollingEnabled() {
+        return pollingEnabled;
+    }
+
+    /**
+     * Copies up to maxEvents received events in the order they arrived to the array passed and returns the
+     * number of events copied. Only one thread may poll at a time, but it doesn't need to be the one that
+     * receives the MIDI data. Pass MIDITimestamp::now() taken right after polling to MIDIEvent::getTimestamp() to
+     * get the receive time of the events.
+     *
+     * @see setPollingEnabled
+     */
+    size_t poll (MIDIEvent *events, size_t maxEvents) {
+        return eventQueue.pop (events, maxEvents);
+    }
+
+    /**
+     * Returns the number of events that were lost so far because the application didn't poll fast enough.
+     * The queue size can be raised by defining SIMPLE_MIDI_EVENT_QUEUE_SIZE before including simpleMIDI.h
+     */
+    uint32_t getNumDroppedEvents() {
+        return numEventsDropped;
+    }
+
     // ----------- These member functions handling incomming data are needed to be implemented by the user --------
     // ----------- They are called from the architecture specific implementation if incomming data is available ---
     
@@ -293,12 +917,6 @@ public:
      */
     virtual void receivedAftertouch (uint8_t note, uint8_t velocity){};
     
-    /**
-     * This value indicates, that the Aftertouch event was no polyphonic Aftertouch event, related to a special
-     * note but a monophonic aftertouch event
-     */
-    static const uint8_t MonophonicAftertouch = 255;
-    
     /**
      * Gets called when a Control Change on the specified MIDI Channel was received. The application has to override
      * this function if it wants to handle Control Change messages.
@@ -308,6 +926,28 @@ public:
      * @see SimpleMIDI::valueToFloat, SimpleMIDI::valueToDouble
      */
     virtual void receivedControlChange (uint8_t control, uint8_t value) {};
+
+    /**
+     * Gets called when an NRPN value was received, only if parameter assembly is enabled. The parameter and its
+     * value are combined from up to four control changes, see setParameterAssembly().
+     * @param parameter Number of the parameter in the range from 0 - 16383
+     * @param value     Value in the range from 0 - 16383. A value sent with the data entry MSB only is MSB << 7
+     */
+    virtual void receivedNRPN (uint16_t parameter, uint16_t value) {};
+
+    /**
+     * Gets called when an RPN value like the pitch bend sensitivity was received, only if parameter assembly is
+     * enabled. Parameter and value are passed like with receivedNRPN().
+     */
+    virtual void receivedRPN (uint16_t parameter, uint16_t value) {};
+
+    /**
+     * Gets called when a 14 bit controller was received, only if assembly of these is enabled. Controllers 0 - 31
+     * carry the MSB, the controllers 32 - 63 the LSB of the value.
+     * @param control   Number of the MSB controller in the range from 0 - 31
+     * @param value     Value in the range from 0 - 16383
+     */
+    virtual void receivedHiResControlChange (uint8_t control, uint16_t value) {};
     
     /**
      * Gets called when a Programm Change on the specified MIDI Channel was received. The application has to override
@@ -333,6 +973,76 @@ public:
      */
     virtual void receivedSysEx (const char *sysExBuffer, const uint16_t length) {};
     
+    /**
+     * Gets called if a SysEx was received that didn't fit into the receive buffer and therefore was dropped, see
+     * SIMPLE_MIDI_SYSEX_BUFFER_SIZE. It's only goal is to notify the receiver that a message was dropped
+     */
+    virtual void droppedSysExBuffer() {};
+    
+    /**
+     * Gets called when the beginning of a SysEx was received. Together with receivedSysExChunk() and receivedSysExEnd()
+     * this streams SysEx messages of any length without buffering them. The default implementations of these three
+     * functions collect the message and pass it to receivedSysEx(), override all three of them to handle the chunks
+     * yourself instead.
+     */
+    virtual void receivedSysExBegin() {
+        sysExOverflow = false;
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        sysExBuffer.assign (1, (char)SysExBegin);
+#else
+        sysExBuffer[0] = SysExBegin;
+        sysExLength = 1;
+#endif
+    };
+    
+    /**
+     * Gets called for each part of a SysEx message that was received, the chunks don't contain the SysExBegin and
+     * SysExEnd bytes. The data points directly into the receive buffer of the connection and will go out of scope
+     * when the function returns.
+     * @param data      A pointer to the received SysEx data bytes
+     * @param length    The number of bytes in this chunk
+     */
+    virtual void receivedSysExChunk (const uint8_t *data, size_t length) {
+        if (sysExOverflow)
+            return;
+        
+        // leave one byte for the SysExEnd
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        if (sysExBuffer.size() + length >= SIMPLE_MIDI_SYSEX_BUFFER_SIZE) {
+#else
+        if (sysExLength + length >= SIMPLE_MIDI_SYSEX_BUFFER_SIZE) {
+#endif
+            sysExOverflow = true;
+            droppedSysExBuffer();
+            return;
+        }
+        
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        sysExBuffer.insert (sysExBuffer.end(), data, data + length);
+#else
+        memcpy (sysExBuffer + sysExLength, data, length);
+        sysExLength += length;
+#endif
+    };
+    
+    /**
+     * Gets called when a SysEx message has ended.
+     * @param complete  True if it was terminated by SysExEnd, false if another command interrupted it
+     */
+    virtual void receivedSysExEnd (bool complete) {
+        if (!complete || sysExOverflow)
+            return;
+        
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        sysExBuffer.push_back ((char)SysExEnd);
+        receivedSysEx (sysExBuffer.data(), (uint16_t)sysExBuffer.size());
+        sysExBuffer.clear();
+#else
+        sysExBuffer[sysExLength++] = SysExEnd;
+        receivedSysEx (sysExBuffer, sysExLength);
+#endif
+    };
+    
     /**
      * Gets called when a MIDI timecode quarter frame was received. The application has to override this function if
      * it wants to handle MIDI timecode messages.
@@ -438,7 +1148,10 @@ public:
     }
     
     
-#ifdef SIMPLE_MIDI_MAC
+#ifdef SIMPLE_MIDI_TTY
+    typedef TTYMIDIDeviceRessource HardwareResource;
+    typedef TTYMIDIWrapper PlatformSpecificImplementation;
+#elif defined SIMPLE_MIDI_MAC
     typedef CoreMIDIDeviceRessource HardwareResource;
     typedef CoreMIDIWrapper PlatformSpecificImplementation;
 #elif defined SIMPLE_MIDI_ARDUINO
@@ -448,149 +1161,1559 @@ public:
     
     
 protected:
-    Channel lastChannel;
-    
+    /**
+     * Writes the bytes to the MIDI output. This is implemented by the architecture specific implementations,
+     * everything that goes out has passed sendRawMIDIBuffer before.
+     */
+    virtual void writeRawMIDIBytes (const uint8_t *bytesToWrite, int length) = 0;
+
+    void sendSingleByte (uint8_t byte) {
+        sendRawMIDIBuffer (&byte, 1);
+    }
+
+    /** Leaves out repeated status bytes if running status is enabled */
+    MIDIRunningStatusEncoder runningStatusEncoder;
+
+    // The (N)RPN parameter selected on each channel as parameter number + 1, with bit 14 set for RPNs
+    static const uint16_t NoParameterSelected = 0;
+    static const uint16_t RPNFlag = 1 << 14;
 #ifdef SIMPLE_MIDI_PRE_C++11
-    // in this case these will be initialized in the derived class' constructor
-    Channel sendChannel;
-    Channel receiveChannel;
+    uint16_t selectedParameter[16];
+    bool parameterNullReset;
 #else
-    Channel sendChannel = Channel1;
-    Channel receiveChannel = ChannelAny;
+    uint16_t selectedParameter[16] = {};
+    bool parameterNullReset = false;
 #endif
-    
-};
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // Checking the selected parameter and sending the message must happen at once if several threads send
+    std::mutex parameterSelectionMutex;
+#endif
+
+    void sendParameter (bool registered, uint16_t parameter, uint8_t valueMSB, uint8_t valueLSB, bool hiRes, Channel channel) {
+        const uint16_t selection = (parameter | (registered ? RPNFlag : 0)) + 1;
+
+        uint8_t sequence[18];
+        int length = 0;
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        std::lock_guard<std::mutex> lock (parameterSelectionMutex);
+#endif
+        // invalid channels like ChannelAny have no cache entry, the parameter is always selected for them
+        const bool isCached = channel <= Channel16;
+        if (!isCached || (selectedParameter[channel] != selection)) {
+            if (registered)
+                length += encodeRPNSelect (channel, parameter, sequence + length);
+            else
+                length += encodeNRPNSelect (channel, parameter, sequence + length);
+            if (isCached)
+                selectedParameter[channel] = selection;
+        }
 
+        if (hiRes)
+            length += encodeHiResDataEntry (channel, (valueMSB << 7) | valueLSB, sequence + length);
+        else
+            length += encodeLoResDataEntry (channel, valueMSB, sequence + length);
 
+        if (parameterNullReset) {
+            length += encodeRPNNull (channel, sequence + length);
+            if (isCached)
+                selectedParameter[channel] = NoParameterSelected;
+        }
 
+        sendRawMIDIBuffer (sequence, length);
+    }
 
+    /** Drops redundant controller messages if output thinning is enabled, created on demand */
+#ifdef SIMPLE_MIDI_PRE_C++11
+    MIDIOutputThinner *outputThinner;
+#else
+    MIDIOutputThinner *outputThinner = NULL;
+#endif
 
+    // Reading the clock is the most expensive part of thinning, it is only needed with a minimum interval
+    uint32_t thinningTime() {
+        return (outputThinner->getMinInterval() > 0) ? (uint32_t)(MIDITimestamp::now() / 1000) : 0;
+    }
 
+    bool passesOutputThinning (const uint8_t *bytesToSend, int length) {
 #ifdef SIMPLE_MIDI_MULTITHREADED
-#include <thread>
-#include <functional>
-#include <mutex>
-#include <chrono>
-/**
- * A class that launches a timer that automatically sends out MIDI clock ticks on a regular basis. If you need
- * high precision better roll out your own version based on some high precision timer.
- */
-class MIDIClockGenerator {
-    
-public:
-    /**
-     * Pass the midiConnection you want to use to send out the clock ticks to initialize the class
-     * in an RAII style.
-     */
-    MIDIClockGenerator (SimpleMIDI &midiConnectionToAttachTo) : midiConnection (midiConnectionToAttachTo) {
-        //nextTick = std::chrono::system_clock::now ();
-        nextTick = std::chrono::steady_clock::now ();
-        // lock the mutex before launching the thread so that it blocks until it was started
-        timerThreadMutex.lock ();
-        timerThread = new std::thread (std::bind (&MIDIClockGenerator::timerThreadWork, this));
+        std::lock_guard<std::mutex> lock (thinningMutex);
+        // thinning might have been disabled since the caller checked
+        if (outputThinner == NULL)
+            return true;
+        const uint16_t numPendingBefore = outputThinner->getNumPending();
+        const bool shouldSend = outputThinner->shouldSend (bytesToSend, length, thinningTime());
+        if (outputThinner->getNumPending() > numPendingBefore)
+            thinningThreadWakeUp.notify_one();
+        return shouldSend;
+#else
+        // without a thread, values whose interval is over go out with the next message sent
+        if (outputThinner->getNumPending() > 0)
+            sendDueThinnedMessages();
+        return outputThinner->shouldSend (bytesToSend, length, thinningTime());
+#endif
     }
-    
-    ~MIDIClockGenerator () {
-        timerThreadShouldExit = true;
-        
-        // if the timer thread is sleeping because the mutex blocks it, wake it up so that it can leave
-        if (!timerIsActive) {
-            timerThreadMutex.unlock ();
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // Guards outputThinner. The flag lets the send path skip the lock while thinning is disabled
+    std::mutex thinningMutex;
+    std::atomic<bool> outputThinningEnabled {false};
+    std::condition_variable thinningThreadWakeUp;
+    std::thread thinningThread;
+    bool thinningThreadShouldExit = false;
+
+    void thinningThreadWork() {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::Send);
+        std::unique_lock<std::mutex> lock (thinningMutex);
+
+        while (!thinningThreadShouldExit) {
+            const int64_t microsecondsToWait = outputThinner->getMicrosecondsUntilNextDue (thinningTime());
+            if (microsecondsToWait < 0) {
+                thinningThreadWakeUp.wait (lock);
+                continue;
+            }
+            if (microsecondsToWait > 0) {
+                thinningThreadWakeUp.wait_for (lock, std::chrono::microseconds (microsecondsToWait));
+                continue;
+            }
+
+            lock.unlock();
+            sendDueThinnedMessages();
+            lock.lock();
         }
-        
-        timerThread->join ();
-        delete timerThread;
-    }
-    
-    /**
-     * Sets the intervall between the clock ticks and starts the timer if not already running.
-     * @param intervallInMilliseconds   Intervall between the clock ticks in milliseconds. Keep in mind that
-     *                                  the standard expects four ticks per quarter note
-     * @param withStartCommand          Sends a MIDI start command before starting the continous clock tick if true
-     * @param withContinueCommand       Sends a MIDI continue command before starting the continous clock tick if true
-     */
-    void setIntervall (uint64_t quarterNoteIntervallInMilliseconds, bool withStartCommand = false, bool withContinueCommand = false) {
-        // convert to nanoseconds for higher precision
-        quarterNoteIntervallInMilliseconds *= 1000000;
-        // convert to the corresponding midi clock tick intervall
-        quarterNoteIntervallInMilliseconds /= 24;
-        
-        // aquire the lock before changing the interval if the timer is already running
-        if (timerIsActive)
-            timerThreadMutex.lock ();
-        
-        interval = std::chrono::nanoseconds (quarterNoteIntervallInMilliseconds);
-        
-        if (withStartCommand)
-            midiConnection.sendMIDIStart();
-        if (withContinueCommand)
-            midiConnection.sendMIDIContinue();
-        
-        timerIsActive = true;
-        
-        //releasing the mutex will start the thread
-        timerThreadMutex.unlock ();
     }
-    
-    /**
-     * Stops the continous clock ticks
-     * @param withStopCommand           Sends a MIDI stop command after stopping the last clock tick
-     */
-    void stop (bool withStopCommand = false) {
-        
-        // aquire the lock, so that the timer thread will sleep.
-        timerThreadMutex.lock ();
-        timerIsActive = false;
-        
-        if (withStopCommand)
-            midiConnection.sendMIDIStop();
+
+    void stopThinningThread() {
+        if (!thinningThread.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock (thinningMutex);
+            thinningThreadShouldExit = true;
+        }
+        thinningThreadWakeUp.notify_one();
+        thinningThread.join();
     }
-    
-private:
-    SimpleMIDI &midiConnection;
-    std::thread *timerThread = nullptr;
-    std::mutex timerThreadMutex;
-    bool timerIsActive = false;
-    bool timerThreadShouldExit = false;
-    std::chrono::nanoseconds interval;
-    std::chrono::steady_clock::time_point nextTick;
-    
-    void timerThreadWork() {
-        // launch an endless loop
-        while (true) {
-            std::this_thread::sleep_until (nextTick);
-            nextTick = std::chrono::steady_clock::now () + interval;
-            
-            // If the timer has been stopped, it will be sleeping at this
-            // point until the mutex was released
-            timerThreadMutex.lock ();
-            if (timerThreadShouldExit)
-                break;
-            
-            midiConnection.sendMIDIClockTick();
-            timerThreadMutex.unlock ();
+#endif
+
+    /** Routes a message that passed the thinning to the wire pacer, the send queue or directly to the device */
+    void sendToOutput (const uint8_t *bytesToSend, int length) {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        if (sendThroughWirePacer (bytesToSend, length))
+            return;
+        if (sendQueue != nullptr) {
+            pushToSendQueue (bytesToSend, length);
+            return;
         }
+#endif
+        writeThroughSendPipeline (bytesToSend, length);
     }
-};
 
 
+
+    // Collects outgoing messages between beginBatch() and flush()
+    uint8_t transmitBuffer[SIMPLE_MIDI_TRANSMIT_BUFFER_SIZE];
+    uint64_t batchStartTime;
+#ifdef SIMPLE_MIDI_PRE_C++11
+    uint16_t numBytesInTransmitBuffer;
+    uint16_t batchMaxBytes;
+    uint64_t batchMaxDelay;
+    bool batchOpen;
+#else
+    uint16_t numBytesInTransmitBuffer = 0;
+    uint16_t batchMaxBytes = SIMPLE_MIDI_TRANSMIT_BUFFER_SIZE;
+    uint64_t batchMaxDelay = 0;
+    bool batchOpen = false;
 #endif
 
+    // Batching, running status and the actual write. Only one thread at a time may be in here
+    void writeThroughSendPipeline (const uint8_t *bytesToSend, int length) {
+        if (batchOpen) {
+            appendToBatch (bytesToSend, length);
+            return;
+        }
 
+        if (!runningStatusEncoder.isEnabled()) {
+            writeRawMIDIBytes (bytesToSend, length);
+            return;
+        }
 
-#ifdef SIMPLE_MIDI_MAC
-#import "ArchitectureSpecific/MacOSX/CoreMIDIWrapperImpl.h"
+        // Copy everything but the status bytes that can be left out to a small buffer. Realtime bytes and
+        // SysEx content have to be copied too, so longer buffers are sent in chunks
+        const int chunkSize = 32;
+        uint8_t chunk[chunkSize];
+        int numBytesInChunk = 0;
 
-#elif defined SIMPLE_MIDI_WINDOWS
-// todo: Implement Windows specific MIDI Class
-#error "Currently no Windows specific implementation of SimpleMIDI"
+        for (int i = 0; i < length; i++) {
+            if (!runningStatusEncoder.shouldSend (bytesToSend[i]))
+                continue;
 
-#elif defined SIMPLE_MIDI_ARDUINO
-#include "ArchitectureSpecific/Arduino/ArduinoSerialMIDIWrapperImpl.h"
+            chunk[numBytesInChunk++] = bytesToSend[i];
+            if (numBytesInChunk == chunkSize) {
+                writeRawMIDIBytes (chunk, numBytesInChunk);
+                numBytesInChunk = 0;
+            }
+        }
 
-#else
-#error "Unknown Plattfom for SimpleMIDI"
+        if (numBytesInChunk > 0)
+            writeRawMIDIBytes (chunk, numBytesInChunk);
+    }
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // A message as it waits for the send thread. Everything that doesn't fit into the slot, which can only be a SysEx,
+    // is copied to the heap
+    struct QueuedMessage {
+        static const int inlineCapacity = 20;
+        uint16_t length;
+        uint8_t bytes[inlineCapacity];
+        uint8_t *longMessage;
+    };
+    typedef MPSCQueue<QueuedMessage, SIMPLE_MIDI_SEND_QUEUE_SIZE> SendQueue;
+
+    SendQueue *sendQueue = nullptr;
+
+    // Set while a MIDIWirePacer is attached, it takes over all outgoing messages. Senders are counted while they use
+    // the pacer and wait while it is detached, so the pacer is never used after it was destroyed and bytes sent
+    // directly to the device can't overtake the ones it still has to write
+    friend class MIDIWirePacer;
+    std::atomic<MIDIWirePacer *> wirePacer {nullptr};
+    std::atomic<int> numSendersInWirePacer {0};
+    std::atomic<bool> wirePacerDetaching {false};
+    bool sendThroughWirePacer (const uint8_t *bytesToSend, int length);
+
+    std::thread sendThread;
+    std::mutex sendThreadMutex;
+    std::condition_variable sendThreadWakeUp;
+    std::atomic<bool> sendThreadSleeping {false};
+    std::atomic<bool> sendThreadShouldExit {false};
 
+    void pushToSendQueue (const uint8_t *bytesToSend, int length) {
+        QueuedMessage m;
+        m.length = length;
+        if (length <= QueuedMessage::inlineCapacity) {
+            memcpy (m.bytes, bytesToSend, length);
+            m.longMessage = nullptr;
+        }
+        else {
+            m.longMessage = new uint8_t[length];
+            memcpy (m.longMessage, bytesToSend, length);
+        }
+
+        while (!sendQueue->push (m))
+            std::this_thread::yield();
+
+        // Only wake the send thread with a system call if it went to sleep, and only from one of the producers. The
+        // fence pairs with the one in sendThreadWork, so that either the send thread sees the new message or this
+        // thread sees it sleeping
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        if (sendThreadSleeping.load (std::memory_order_relaxed) && sendThreadSleeping.exchange (false))
+            wakeUpSendThread();
+    }
+
+    void wakeUpSendThread() {
+        std::lock_guard<std::mutex> lock (sendThreadMutex);
+        sendThreadWakeUp.notify_one();
+    }
+
+    void sendThreadWork() {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::Send);
+        QueuedMessage m;
+        batchOpen = true;
+
+        while (true) {
+            if (sendQueue->pop (m)) {
+                if (m.longMessage == nullptr) {
+                    writeThroughSendPipeline (m.bytes, m.length);
+                }
+                else {
+                    writeThroughSendPipeline (m.longMessage, m.length);
+                    delete[] m.longMessage;
+                }
+                continue;
+            }
+
+            // the queue ran empty, so write everything collected so far before waiting for more
+            flushTransmitBuffer();
+
+            std::unique_lock<std::mutex> lock (sendThreadMutex);
+            sendThreadSleeping.store (true, std::memory_order_relaxed);
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+
+            if (sendQueue->empty()) {
+                if (sendThreadShouldExit)
+                    break;
+                sendThreadWakeUp.wait (lock);
+            }
+            sendThreadSleeping.store (false, std::memory_order_relaxed);
+        }
+
+        batchOpen = false;
+    }
+#endif
+
+    void appendToBatch (const uint8_t *bytesToSend, int length) {
+        // Keep messages in one piece, CoreMIDI expects complete messages in each packet
+        if (numBytesInTransmitBuffer + length > batchMaxBytes)
+            flushTransmitBuffer();
+
+        if (length > batchMaxBytes) {
+            // a long SysEx that doesn't fit into the buffer at all goes out on its own
+            batchOpen = false;
+            writeThroughSendPipeline (bytesToSend, length);
+            batchOpen = true;
+            return;
+        }
+
+        if ((numBytesInTransmitBuffer == 0) && (batchMaxDelay != 0))
+            batchStartTime = MIDITimestamp::now();
+
+        if (runningStatusEncoder.isEnabled()) {
+            for (int i = 0; i < length; i++) {
+                if (runningStatusEncoder.shouldSend (bytesToSend[i]))
+                    transmitBuffer[numBytesInTransmitBuffer++] = bytesToSend[i];
+            }
+        }
+        else {
+            memcpy (transmitBuffer + numBytesInTransmitBuffer, bytesToSend, length);
+            numBytesInTransmitBuffer += length;
+        }
+
+        if ((numBytesInTransmitBuffer >= batchMaxBytes) || ((batchMaxDelay != 0) && (MIDITimestamp::now() - batchStartTime >= batchMaxDelay)))
+            flushTransmitBuffer();
+    }
+
+    void flushTransmitBuffer() {
+        if (numBytesInTransmitBuffer == 0)
+            return;
+
+        writeRawMIDIBytes (transmitBuffer, numBytesInTransmitBuffer);
+        numBytesInTransmitBuffer = 0;
+    }
+#ifdef SIMPLE_MIDI_PRE_C++11
+    bool supportsRunningStatus;
+#else
+    bool supportsRunningStatus = true;
+#endif
+
+    // The parser needs to know the receive channel and updates the most recent source channel
+    template <typename Receiver> friend class MIDIParser;
+    
+    /**
+     * Decodes all incoming bytes and invokes the receivedXYZ() callbacks. The architecture specific
+     * implementations feed everything they receive into it.
+     */
+    MIDIParser<SimpleMIDI> receiveParser;
+
+    // Combines (N)RPN and 14 bit controller messages if enabled, created on demand
+    template <typename Receiver> friend class MIDIParameterAssembler;
+#ifdef SIMPLE_MIDI_PRE_C++11
+    ParameterAssembler *parameterAssembler;
+#else
+    ParameterAssembler *parameterAssembler = NULL;
+#endif
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    // The receive path only takes the lock while assembly is enabled, the pointer is only read under the lock
+    std::mutex parameterAssemblyMutex;
+    std::atomic<bool> parameterAssemblyEnabled {false};
+#endif
+
+    /** Called by the parser for every control change, returns true if it was part of a combined message */
+    bool assembleControlChange (uint8_t control, uint8_t value) {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        if (!parameterAssemblyEnabled.load (std::memory_order_relaxed))
+            return false;
+        std::lock_guard<std::mutex> lock (parameterAssemblyMutex);
+#endif
+        if (parameterAssembler == NULL)
+            return false;
+
+        return parameterAssembler->controlChange (*this, lastChannel, control, value, (uint32_t)(receiveTimestamp / 1000));
+    }
+
+    /**
+     * Passes on the MSBs that waited for their LSB too long. Implementations call this regularly while waiting for
+     * input, getParameterAssemblyTimeout() tells when it is needed next.
+     */
+    void expireParameterAssembly() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        if (!parameterAssemblyEnabled.load (std::memory_order_relaxed))
+            return;
+        std::lock_guard<std::mutex> lock (parameterAssemblyMutex);
+#endif
+        if (parameterAssembler != NULL)
+            parameterAssembler->expirePendingMSBs (*this, (uint32_t)(MIDITimestamp::now() / 1000));
+    }
+
+    /** Returns the number of milliseconds until expireParameterAssembly() has work to do or -1 if it has none */
+    int getParameterAssemblyTimeout() {
+#ifdef SIMPLE_MIDI_MULTITHREADED
+        if (!parameterAssemblyEnabled.load (std::memory_order_relaxed))
+            return -1;
+        std::lock_guard<std::mutex> lock (parameterAssemblyMutex);
+#endif
+        if (parameterAssembler == NULL)
+            return -1;
+
+        const int64_t microseconds = parameterAssembler->getMicrosecondsUntilExpiry ((uint32_t)(MIDITimestamp::now() / 1000));
+        return (microseconds < 0) ? -1 : (int)((microseconds + 999) / 1000);
+    }
+
+    /** Called by the parser for every message, returns true if it was stored for polling */
+    bool queueReceivedEvent (uint8_t status, uint8_t data1, uint8_t data2) {
+        if (!pollingEnabled)
+            return false;
+
+        MIDIEvent event = {status, data1, data2, 0, (uint32_t)(receiveTimestamp / 1000)};
+        if (!eventQueue.push (event))
+            numEventsDropped++;
+        return true;
+    }
+
+    // Received events waiting to be polled
+    SPSCQueue<MIDIEvent, SIMPLE_MIDI_EVENT_QUEUE_SIZE> eventQueue;
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    std::atomic<bool> pollingEnabled {false};
+    std::atomic<uint32_t> numEventsDropped {0};
+#else
+#ifdef SIMPLE_MIDI_PRE_C++11
+    bool pollingEnabled;
+    uint32_t numEventsDropped;
+#else
+    bool pollingEnabled = false;
+    uint32_t numEventsDropped = 0;
+#endif
+#endif
+    
+    Channel lastChannel;
+
+    /** Set by the architecture specific implementations before they feed received bytes into the parser */
+#ifdef SIMPLE_MIDI_PRE_C++11
+    uint64_t receiveTimestamp;
+#else
+    uint64_t receiveTimestamp = 0;
+#endif
+    
+    // Collects incoming SysEx chunks for receivedSysEx()
+#ifdef SIMPLE_MIDI_MULTITHREADED
+    std::vector<char> sysExBuffer;
+#else
+    char sysExBuffer[SIMPLE_MIDI_SYSEX_BUFFER_SIZE];
+    uint16_t sysExLength;
+#endif
+    bool sysExOverflow;
+    
+#ifdef SIMPLE_MIDI_PRE_C++11
+    // in this case these will be initialized in the derived class' constructor
+    Channel sendChannel;
+    Channel receiveChannel;
+#else
+    Channel sendChannel = Channel1;
+    Channel receiveChannel = ChannelAny;
+#endif
+
+    // Checked by the parser for every status byte
+#ifdef SIMPLE_MIDI_PRE_C++11
+    uint16_t receiveChannelMask;
+    uint32_t receiveMessageMask;
+#else
+    uint16_t receiveChannelMask = 0xFFFF;
+    uint32_t receiveMessageMask = AllMessages;
+#endif
+    
+};
+
+
+
+
+
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+#include <thread>
+#include <functional>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <queue>
+#include <deque>
+#include <algorithm>
+#ifdef SIMPLE_MIDI_TTY
+#include <sys/prctl.h>
+#endif
+/**
+ * Sends MIDI clock ticks, 24 per quarter note, on a grid of absolute deadlines. Each deadline is computed from the
+ * tick that started the current tempo, so a late wake up delays a single tick but never the ones after it and the
+ * tempo doesn't drift. The timer thread sleeps until shortly before each deadline and spins for the rest, which
+ * takes the sleep's wake up latency out of the jitter at the cost of the spin time in CPU per tick.
+ *
+ * Start, continue and stop can be scheduled for exact timestamps of the MIDITimestamp clock, the same clock that
+ * MIDIOutputScheduler uses. The transport message is sent at that time, followed right away by the first tick of
+ * the new grid on start and continue. The timer thread looks for new commands at least every 5 ms, schedule them
+ * that far ahead if they have to be on time.
+ *
+ * The tempo can be changed from any thread at any time without a lock, the new tempo takes effect with the next
+ * tick. The generator sends through the SimpleMIDI instance it is attached to from its own thread.
+ */
+class MIDIClockGenerator {
+
+public:
+
+    /**
+     * The difference between the time each tick was sent and its deadline. Bucket 0 counts all ticks that were
+     * sent less than 1 us late, bucket n the ones between 2^(n-1) and 2^n us late and the last bucket everything
+     * later. The counters are updated without a lock, so a snapshot taken while ticks are sent might be off by one.
+     */
+    struct TickJitterHistogram {
+        static const int numBuckets = 16;
+        uint32_t buckets[numBuckets];
+        uint32_t numTicks;
+        uint64_t meanErrorNanoseconds;
+        uint64_t maxErrorNanoseconds;
+    };
+
+    /**
+     * Pass the midiConnection you want to use to send out the clock ticks to initialize the class
+     * in an RAII style.
+     */
+    MIDIClockGenerator (SimpleMIDI &midiConnectionToAttachTo) : midiConnection (midiConnectionToAttachTo) {
+        resetJitterHistogram();
+        timerThread = std::thread (&MIDIClockGenerator::timerThreadWork, this);
+    }
+
+    ~MIDIClockGenerator() {
+        {
+            std::lock_guard<std::mutex> lock (commandMutex);
+            timerThreadShouldExit.store (true, std::memory_order_relaxed);
+        }
+        newCommand.notify_one();
+        timerThread.join();
+    }
+
+    /** Sets the tempo in beats per minute, fractions are allowed. Takes effect with the next tick */
+    void setTempo (double beatsPerMinute) {
+        if (beatsPerMinute > 0)
+            tempo.store (beatsPerMinute, std::memory_order_relaxed);
+    }
+
+    double getTempo() const {
+        return tempo.load (std::memory_order_relaxed);
+    }
+
+    /**
+     * Starts the ticks at the timestamp passed, the first tick is sent right at that time. Restarts the grid if
+     * the ticks are running already.
+     * @param withStartCommand  Sends a MIDI start command right before the first tick if true
+     */
+    void startAt (uint64_t timestamp, bool withStartCommand = true) {
+        schedule (timestamp, withStartCommand ? StartCommand : StartSilently);
+    }
+
+    /** Sends a MIDI continue command at the timestamp passed and starts the ticks right after it */
+    void continueAt (uint64_t timestamp) {
+        schedule (timestamp, ContinueCommand);
+    }
+
+    /**
+     * Stops the ticks at the timestamp passed, no tick due at that time or later is sent.
+     * @param withStopCommand   Sends a MIDI stop command at that time if true
+     */
+    void stopAt (uint64_t timestamp, bool withStopCommand = true) {
+        schedule (timestamp, withStopCommand ? StopCommand : StopSilently);
+    }
+
+    /** Returns true if ticks are being sent */
+    bool isRunning() const {
+        return running.load (std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets the intervall between the clock ticks and starts the timer if not already running.
+     * @param intervallInMilliseconds   Intervall between the clock ticks in milliseconds. Keep in mind that
+     *                                  the standard expects four ticks per quarter note
+     * @param withStartCommand          Sends a MIDI start command before starting the continous clock tick if true
+     * @param withContinueCommand       Sends a MIDI continue command before starting the continous clock tick if true
+     */
+    void setIntervall (uint64_t quarterNoteIntervallInMilliseconds, bool withStartCommand = false, bool withContinueCommand = false) {
+        if (quarterNoteIntervallInMilliseconds == 0)
+            return;
+
+        setTempo (60000.0 / quarterNoteIntervallInMilliseconds);
+
+        if (withStartCommand)
+            startAt (MIDITimestamp::now());
+        else if (withContinueCommand)
+            continueAt (MIDITimestamp::now());
+        else if (!isRunning())
+            startAt (MIDITimestamp::now(), false);
+    }
+
+    /**
+     * Stops the continous clock ticks right away. When this returns, no further tick is sent and the stop command
+     * has been sent, so the generator can be destroyed right after. Transport commands that were due by now but
+     * not sent yet go out before it, later ones stay scheduled.
+     * @param withStopCommand           Sends a MIDI stop command after stopping the last clock tick
+     */
+    void stop (bool withStopCommand = false) {
+        std::lock_guard<std::mutex> transportLock (transportMutex);
+        {
+            std::lock_guard<std::mutex> lock (commandMutex);
+            const uint64_t now = MIDITimestamp::now();
+            while (!commands.empty() && (commands.front().timestamp <= now)) {
+                sendTransportMessage (commands.front().type);
+                commands.pop_front();
+            }
+            earliestCommand.store (commands.empty() ? noCommand : commands.front().timestamp, std::memory_order_release);
+        }
+
+        // The timer thread only touches the grid while it holds transportMutex and checks this flag first
+        running.store (false, std::memory_order_relaxed);
+        if (withStopCommand)
+            midiConnection.sendMIDIStop();
+    }
+
+    /**
+     * Sets how long before each deadline the timer thread stops sleeping and starts spinning. It should cover
+     * the wake up latency of the system, about 100 us on an idle Linux system with the default scheduling and a
+     * few us with realtime scheduling. The default is 200 us, 0 only sleeps.
+     */
+    void setSpinTime (uint32_t microseconds) {
+        spinTime.store ((uint64_t)microseconds * 1000, std::memory_order_relaxed);
+    }
+
+    TickJitterHistogram getJitterHistogram() const {
+        TickJitterHistogram histogram;
+        for (int i = 0; i < TickJitterHistogram::numBuckets; i++)
+            histogram.buckets[i] = jitterBuckets[i].load (std::memory_order_relaxed);
+        histogram.numTicks = numTicksMeasured.load (std::memory_order_relaxed);
+        const uint64_t sum = sumOfErrors.load (std::memory_order_relaxed);
+        histogram.meanErrorNanoseconds = (histogram.numTicks > 0) ? sum / histogram.numTicks : 0;
+        histogram.maxErrorNanoseconds = maxError.load (std::memory_order_relaxed);
+        return histogram;
+    }
+
+    void resetJitterHistogram() {
+        for (int i = 0; i < TickJitterHistogram::numBuckets; i++)
+            jitterBuckets[i].store (0, std::memory_order_relaxed);
+        numTicksMeasured.store (0, std::memory_order_relaxed);
+        sumOfErrors.store (0, std::memory_order_relaxed);
+        maxError.store (0, std::memory_order_relaxed);
+    }
+
+private:
+
+    enum CommandType : uint8_t {
+        StartCommand,
+        StartSilently,
+        ContinueCommand,
+        StopCommand,
+        StopSilently
+    };
+
+    struct Command {
+        uint64_t timestamp;
+        CommandType type;
+    };
+
+    static const uint64_t noCommand = UINT64_MAX;
+    static const uint64_t maxSleepSlice = 5000000;
+    // A grid that is further behind than a quarter note is moved to now instead of sending all ticks missed
+    static const uint64_t maxTicksToCatchUp = 24;
+
+    SimpleMIDI &midiConnection;
+    std::thread timerThread;
+    std::atomic<bool> timerThreadShouldExit {false};
+    std::atomic<double> tempo {120.0};
+    std::atomic<uint64_t> spinTime {200000};
+    std::atomic<bool> running {false};
+
+    // Held by the timer thread while it executes commands or sends a tick and by stop(), so that a stop can't
+    // interleave with a tick that is being sent
+    std::mutex transportMutex;
+
+    // Guards the commands, which are sorted by their timestamp. Only the timer thread reads the grid below
+    std::mutex commandMutex;
+    std::condition_variable newCommand;
+    std::deque<Command> commands;
+    std::atomic<uint64_t> earliestCommand {noCommand};
+
+    uint64_t gridStart = 0;
+    uint64_t ticksSinceGridStart = 0;
+    double gridInterval = 0;
+
+    std::atomic<uint32_t> jitterBuckets[TickJitterHistogram::numBuckets];
+    std::atomic<uint32_t> numTicksMeasured;
+    std::atomic<uint64_t> sumOfErrors;
+    std::atomic<uint64_t> maxError;
+
+    static double tickInterval (double beatsPerMinute) {
+        return 60e9 / (beatsPerMinute * 24.0);
+    }
+
+    void schedule (uint64_t timestamp, CommandType type) {
+        {
+            std::lock_guard<std::mutex> lock (commandMutex);
+            Command command = {timestamp, type};
+            std::deque<Command>::iterator position = commands.begin();
+            while ((position != commands.end()) && (position->timestamp <= timestamp))
+                ++position;
+            commands.insert (position, command);
+            earliestCommand.store (commands.front().timestamp, std::memory_order_release);
+        }
+        newCommand.notify_one();
+    }
+
+    uint64_t nextTickDeadline() const {
+        return gridStart + (uint64_t)(ticksSinceGridStart * gridInterval + 0.5);
+    }
+
+    /**
+     * Sleeps until spinTime before the deadline and spins for the rest. Returns false without reaching the
+     * deadline after sleeping maxSleepSlice, so that new commands and the exit flag are seen in time
+     */
+    bool waitUntil (uint64_t deadline) {
+        const uint64_t spin = spinTime.load (std::memory_order_relaxed);
+        const uint64_t now = MIDITimestamp::now();
+
+        if ((int64_t)(deadline - now) > (int64_t)spin) {
+            const uint64_t sleepTime = deadline - now - spin;
+            if (sleepTime > maxSleepSlice) {
+                std::this_thread::sleep_for (std::chrono::nanoseconds ((int64_t)maxSleepSlice));
+                return false;
+            }
+            std::this_thread::sleep_for (std::chrono::nanoseconds (sleepTime));
+        }
+
+        while ((int64_t)(deadline - MIDITimestamp::now()) > 0) {}
+        return true;
+    }
+
+    void executeDueCommands (uint64_t now) {
+        std::unique_lock<std::mutex> lock (commandMutex);
+
+        while (!commands.empty() && (commands.front().timestamp <= now)) {
+            const Command command = commands.front();
+            commands.pop_front();
+            sendTransportMessage (command.type);
+
+            if ((command.type == StopCommand) || (command.type == StopSilently)) {
+                running.store (false, std::memory_order_relaxed);
+                continue;
+            }
+
+            // the first tick of the new grid follows the transport message right away
+            gridStart = command.timestamp;
+            gridInterval = tickInterval (tempo.load (std::memory_order_relaxed));
+            ticksSinceGridStart = 0;
+            running.store (true, std::memory_order_relaxed);
+        }
+
+        earliestCommand.store (commands.empty() ? noCommand : commands.front().timestamp, std::memory_order_release);
+    }
+
+    void sendTransportMessage (CommandType type) {
+        switch (type) {
+            case StartCommand:
+                midiConnection.sendMIDIStart();
+                break;
+            case ContinueCommand:
+                midiConnection.sendMIDIContinue();
+                break;
+            case StopCommand:
+                midiConnection.sendMIDIStop();
+                break;
+            default:
+                break;
+        }
+    }
+
+    void sendTick (uint64_t deadline) {
+        midiConnection.sendMIDIClockTick();
+        addToHistogram ((int64_t)(MIDITimestamp::now() - deadline));
+
+        // A tempo change starts a new grid at the tick just sent, so the ticks before it don't move
+        ticksSinceGridStart++;
+        const double interval = tickInterval (tempo.load (std::memory_order_relaxed));
+        if (interval != gridInterval) {
+            gridStart = deadline;
+            gridInterval = interval;
+            ticksSinceGridStart = 1;
+        }
+
+        if ((int64_t)(MIDITimestamp::now() - nextTickDeadline()) > (int64_t)(maxTicksToCatchUp * gridInterval)) {
+            gridStart = MIDITimestamp::now();
+            ticksSinceGridStart = 0;
+        }
+    }
+
+    void timerThreadWork() {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::Timing);
+#ifdef SIMPLE_MIDI_TTY
+        // The default timer slack of 50 us would be added to every sleep
+        prctl (PR_SET_TIMERSLACK, 1);
+#endif
+        while (!timerThreadShouldExit.load (std::memory_order_relaxed)) {
+            const uint64_t commandDeadline = earliestCommand.load (std::memory_order_acquire);
+            const bool isRunning = running.load (std::memory_order_relaxed);
+
+            // sleep until a command arrives, only the commands take the lock
+            if (!isRunning && (commandDeadline == noCommand)) {
+                std::unique_lock<std::mutex> lock (commandMutex);
+                while (commands.empty() && !timerThreadShouldExit.load (std::memory_order_relaxed))
+                    newCommand.wait (lock);
+                continue;
+            }
+
+            const uint64_t tickDeadline = isRunning ? nextTickDeadline() : noCommand;
+            const uint64_t deadline = std::min (tickDeadline, commandDeadline);
+            if (!waitUntil (deadline))
+                continue;
+
+            std::lock_guard<std::mutex> transportLock (transportMutex);
+
+            // a command due at the same time as a tick comes first, so a stop suppresses the tick
+            if (commandDeadline <= tickDeadline)
+                executeDueCommands (deadline);
+
+            if (running.load (std::memory_order_relaxed)) {
+                const uint64_t nextDeadline = nextTickDeadline();
+                if ((int64_t)(MIDITimestamp::now() - nextDeadline) >= 0)
+                    sendTick (nextDeadline);
+            }
+        }
+    }
+
+    void addToHistogram (int64_t error) {
+        if (error < 0)
+            error = 0;
+
+        numTicksMeasured.fetch_add (1, std::memory_order_relaxed);
+        sumOfErrors.fetch_add ((uint64_t)error, std::memory_order_relaxed);
+        if ((uint64_t)error > maxError.load (std::memory_order_relaxed))
+            maxError.store ((uint64_t)error, std::memory_order_relaxed);
+
+        const uint64_t microseconds = error / 1000;
+        int bucket = (microseconds == 0) ? 0 : 64 - __builtin_clzll (microseconds);
+        if (bucket >= TickJitterHistogram::numBuckets)
+            bucket = TickJitterHistogram::numBuckets - 1;
+        jitterBuckets[bucket].fetch_add (1, std::memory_order_relaxed);
+    }
+};
+
+
+/**
+ * Sends messages at exact points in time, e.g. for sequencing or to compensate the latency of an audio engine.
+ * Messages are scheduled with a timestamp of the MIDITimestamp clock, the same clock all receive timestamps come
+ * from, and kept in a heap ordered by their due time. A dispatcher thread sleeps until the earliest message is due
+ * and sends all messages that are due by then in one batch, so messages scheduled for the same time leave with a
+ * single write.
+ *
+ * Messages with the same timestamp are sent in the order they were scheduled. The scheduler sends through the
+ * SimpleMIDI instance it is attached to from its own thread, so don't send through that instance from another
+ * thread directly while the scheduler is active.
+ */
+class MIDIOutputScheduler {
+
+public:
+
+    /**
+     * The difference between the time a message was sent and the time it was due. Bucket 0 counts all messages
+     * that were sent less than 1 us late, bucket n the ones between 2^(n-1) and 2^n us late and the last bucket
+     * everything later. Messages sent early because of the batch window count as on time.
+     */
+    struct SchedulingErrorHistogram {
+        static const int numBuckets = 16;
+        uint32_t buckets[numBuckets];
+        uint32_t numMessages;
+        uint64_t maxErrorNanoseconds;
+    };
+
+    MIDIOutputScheduler (SimpleMIDI &midiConnectionToAttachTo) : midiConnection (midiConnectionToAttachTo) {
+        resetHistogram();
+        dispatcherThread = std::thread (&MIDIOutputScheduler::dispatcherThreadWork, this);
+    }
+
+    ~MIDIOutputScheduler() {
+        {
+            std::lock_guard<std::mutex> lock (queueMutex);
+            dispatcherThreadShouldExit = true;
+        }
+        wakeUpDispatcher.notify_one();
+        dispatcherThread.join();
+    }
+
+    /**
+     * Schedules a complete message of up to 3 bytes to be sent at the timestamp given in nanoseconds of the
+     * MIDITimestamp clock. Messages that are already due are sent as soon as possible.
+     * @return  false if the message is longer than 3 bytes, SysEx messages can't be scheduled
+     */
+    bool sendAt (uint64_t timestamp, const uint8_t *message, uint8_t length) {
+        if ((length == 0) || (length > 3))
+            return false;
+
+        ScheduledMessage scheduledMessage;
+        scheduledMessage.dueTime = timestamp;
+        scheduledMessage.length = length;
+        memcpy (scheduledMessage.bytes, message, length);
+
+        bool isNewEarliest;
+        {
+            std::lock_guard<std::mutex> lock (queueMutex);
+            scheduledMessage.sequenceNumber = nextSequenceNumber++;
+            isNewEarliest = queue.empty() || (timestamp < queue.top().dueTime);
+            queue.push (scheduledMessage);
+        }
+
+        // the dispatcher only needs to recalculate its wake up time if the new message is due before all others
+        if (isNewEarliest)
+            wakeUpDispatcher.notify_one();
+        return true;
+    }
+
+    SimpleMIDI::RetValue sendNoteAt (uint64_t timestamp, uint8_t note, uint8_t velocity, bool onOff) {
+        return sendNoteAt (timestamp, note, velocity, onOff, midiConnection.getSendChannel());
+    }
+
+    SimpleMIDI::RetValue sendNoteAt (uint64_t timestamp, uint8_t note, uint8_t velocity, bool onOff, SimpleMIDI::Channel channel) {
+        if ((note >> 7) != 0)
+            return SimpleMIDI::FirstArgumentOutOfRange;
+        if ((velocity >> 7) != 0)
+            return SimpleMIDI::SecondArgumentOutOfRange;
+
+        uint8_t message[3];
+        if (onOff == SimpleMIDI::NoteOn)
+            encodeNoteOn (channel, note, velocity, message);
+        else
+            encodeNoteOff (channel, note, velocity, message);
+
+        sendAt (timestamp, message, 3);
+        return SimpleMIDI::Success;
+    }
+
+    SimpleMIDI::RetValue sendControlChangeAt (uint64_t timestamp, uint8_t control, uint8_t value) {
+        return sendControlChangeAt (timestamp, control, value, midiConnection.getSendChannel());
+    }
+
+    SimpleMIDI::RetValue sendControlChangeAt (uint64_t timestamp, uint8_t control, uint8_t value, SimpleMIDI::Channel channel) {
+        if ((control >> 7) != 0)
+            return SimpleMIDI::FirstArgumentOutOfRange;
+        if ((value >> 7) != 0)
+            return SimpleMIDI::SecondArgumentOutOfRange;
+
+        uint8_t message[3];
+        sendAt (timestamp, message, encodeControlChange (channel, control, value, message));
+        return SimpleMIDI::Success;
+    }
+
+    SimpleMIDI::RetValue sendProgramChangeAt (uint64_t timestamp, uint8_t program) {
+        return sendProgramChangeAt (timestamp, program, midiConnection.getSendChannel());
+    }
+
+    SimpleMIDI::RetValue sendProgramChangeAt (uint64_t timestamp, uint8_t program, SimpleMIDI::Channel channel) {
+        if ((program >> 7) != 0)
+            return SimpleMIDI::FirstArgumentOutOfRange;
+
+        uint8_t message[2];
+        sendAt (timestamp, message, encodeProgramChange (channel, program, message));
+        return SimpleMIDI::Success;
+    }
+
+    SimpleMIDI::RetValue sendPitchBendAt (uint64_t timestamp, int16_t pitch) {
+        return sendPitchBendAt (timestamp, pitch, midiConnection.getSendChannel());
+    }
+
+    SimpleMIDI::RetValue sendPitchBendAt (uint64_t timestamp, int16_t pitch, SimpleMIDI::Channel channel) {
+        if ((pitch < -8192) || (pitch > 8191))
+            return SimpleMIDI::FirstArgumentOutOfRange;
+
+        uint8_t message[3];
+        sendAt (timestamp, message, encodePitchBend (channel, pitch, message));
+        return SimpleMIDI::Success;
+    }
+
+    void sendMIDIClockTickAt (uint64_t timestamp) {
+        const uint8_t message = SimpleMIDI::ClockTickCmd;
+        sendAt (timestamp, &message, 1);
+    }
+
+    /**
+     * Sends every message this much earlier than its timestamp, to compensate the latency of the output, e.g. of a
+     * MIDI interface with a known delay. Negative values delay all messages instead.
+     */
+    void setLatencyOffset (int32_t latencyOffsetMicroseconds) {
+        std::lock_guard<std::mutex> lock (queueMutex);
+        latencyOffset = (int64_t)latencyOffsetMicroseconds * 1000;
+        wakeUpDispatcher.notify_one();
+    }
+
+    /**
+     * Messages due less than this time after the one that woke up the dispatcher are sent with it in the same
+     * batch. This trades a little precision for fewer writes, 0 (the default) sends only messages that are due.
+     */
+    void setBatchWindow (uint32_t batchWindowMicroseconds) {
+        std::lock_guard<std::mutex> lock (queueMutex);
+        batchWindow = (uint64_t)batchWindowMicroseconds * 1000;
+    }
+
+    /** Removes all messages that were not sent yet, e.g. when the sequencer stops */
+    void clear() {
+        std::lock_guard<std::mutex> lock (queueMutex);
+        queue = std::priority_queue<ScheduledMessage, std::vector<ScheduledMessage>, DueLater>();
+    }
+
+    /** Returns the number of messages waiting to be sent */
+    size_t getNumPendingMessages() {
+        std::lock_guard<std::mutex> lock (queueMutex);
+        return queue.size();
+    }
+
+    SchedulingErrorHistogram getSchedulingErrorHistogram() {
+        std::lock_guard<std::mutex> lock (queueMutex);
+        return histogram;
+    }
+
+    void resetHistogram() {
+        std::lock_guard<std::mutex> lock (queueMutex);
+        memset (&histogram, 0, sizeof (histogram));
+    }
+
+private:
+
+    struct ScheduledMessage {
+        uint64_t dueTime;
+        uint64_t sequenceNumber;
+        uint8_t bytes[3];
+        uint8_t length;
+    };
+
+    // std::priority_queue puts the greatest element on top, so the comparison is inverted to get the earliest
+    struct DueLater {
+        bool operator() (const ScheduledMessage &a, const ScheduledMessage &b) const {
+            if (a.dueTime != b.dueTime)
+                return a.dueTime > b.dueTime;
+            return a.sequenceNumber > b.sequenceNumber;
+        }
+    };
+
+    SimpleMIDI &midiConnection;
+    std::thread dispatcherThread;
+    std::mutex queueMutex;
+    std::condition_variable wakeUpDispatcher;
+    std::priority_queue<ScheduledMessage, std::vector<ScheduledMessage>, DueLater> queue;
+    uint64_t nextSequenceNumber = 0;
+    int64_t latencyOffset = 0;
+    uint64_t batchWindow = 0;
+    bool dispatcherThreadShouldExit = false;
+    SchedulingErrorHistogram histogram;
+
+    void dispatcherThreadWork() {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::Timing);
+#ifdef SIMPLE_MIDI_TTY
+        // The default timer slack of 50 us would be added to every wake up
+        prctl (PR_SET_TIMERSLACK, 1);
+#endif
+        std::vector<ScheduledMessage> batch;
+        std::unique_lock<std::mutex> lock (queueMutex);
+
+        while (!dispatcherThreadShouldExit) {
+            if (queue.empty()) {
+                wakeUpDispatcher.wait (lock);
+                continue;
+            }
+
+            const uint64_t now = MIDITimestamp::now();
+            const uint64_t sendTime = queue.top().dueTime - latencyOffset;
+            if ((int64_t)(sendTime - now) > 0) {
+                wakeUpDispatcher.wait_for (lock, std::chrono::nanoseconds (sendTime - now));
+                continue;
+            }
+
+            const uint64_t batchEnd = now + batchWindow + latencyOffset;
+            while (!queue.empty() && ((int64_t)(queue.top().dueTime - batchEnd) <= 0)) {
+                batch.push_back (queue.top());
+                queue.pop();
+            }
+
+            // Send without holding the lock, so that new messages can be scheduled in the meantime
+            lock.unlock();
+            midiConnection.beginBatch();
+            for (const ScheduledMessage &m : batch)
+                midiConnection.sendRawMIDIBuffer (m.bytes, m.length);
+            midiConnection.flush();
+            const uint64_t sentTime = MIDITimestamp::now();
+            lock.lock();
+
+            for (const ScheduledMessage &m : batch)
+                addToHistogram ((int64_t)(sentTime - (m.dueTime - latencyOffset)));
+            batch.clear();
+        }
+    }
+
+    void addToHistogram (int64_t error) {
+        histogram.numMessages++;
+        if (error <= 0)
+            error = 0;
+        if ((uint64_t)error > histogram.maxErrorNanoseconds)
+            histogram.maxErrorNanoseconds = error;
+
+        const uint64_t microseconds = error / 1000;
+        int bucket = (microseconds == 0) ? 0 : 64 - __builtin_clzll (microseconds);
+        if (bucket >= SchedulingErrorHistogram::numBuckets)
+            bucket = SchedulingErrorHistogram::numBuckets - 1;
+        histogram.buckets[bucket]++;
+    }
+};
+
+
+/**
+ * Lets a realtime thread, e.g. an audio callback, send MIDI without ever blocking. The send functions only encode
+ * the message and push it to a wait free single producer / single consumer ring, they neither lock, allocate nor
+ * call into the driver. An I/O thread owned by this class drains the ring at a fixed interval and writes all
+ * messages it finds with a single batch to the SimpleMIDI connection.
+ *
+ * Only one thread may call the send functions. The I/O thread sends through the SimpleMIDI instance, so don't send
+ * through that instance from another thread directly while the sender is active.
+ *
+ * If the ring is full, the new message is dropped and counted, the realtime thread never waits for the I/O thread.
+ * With the KeepRoomForNoteOffs policy the last eighth of the ring only accepts note offs, so that a burst of other
+ * messages can't leave notes hanging.
+ */
+class MIDIRealtimeSender : public CacheLineAligned {
+
+public:
+
+    enum OverflowPolicy : uint8_t {
+        DropNewMessage,
+        KeepRoomForNoteOffs
+    };
+
+    /**
+     * @param midiConnectionToAttachTo  The connection all messages are written to
+     * @param drainIntervalMicroseconds The time the I/O thread sleeps between two looks at the ring. This adds up to
+     *                                  this much latency to each message
+     */
+    MIDIRealtimeSender (SimpleMIDI &midiConnectionToAttachTo, uint32_t drainIntervalMicroseconds = 1000, OverflowPolicy policy = KeepRoomForNoteOffs)
+      : midiConnection (midiConnectionToAttachTo), drainInterval (drainIntervalMicroseconds), overflowPolicy (policy) {
+        ioThread = std::thread (&MIDIRealtimeSender::ioThreadWork, this);
+    }
+
+    /** Sends all messages still in the ring before it returns */
+    ~MIDIRealtimeSender() {
+        ioThreadShouldExit = true;
+        ioThread.join();
+    }
+
+    // All send functions return false if the message was dropped because the ring was full or an argument is out
+    // of range. They may be called from a realtime thread
+    bool sendNote (uint8_t note, uint8_t velocity, bool onOff, SimpleMIDI::Channel channel) {
+        if (((note | velocity) >> 7) != 0)
+            return false;
+
+        QueuedMessage m;
+        if (onOff == SimpleMIDI::NoteOn)
+            m.length = encodeNoteOn (channel, note, velocity, m.bytes);
+        else
+            m.length = encodeNoteOff (channel, note, velocity, m.bytes);
+        return push (m);
+    }
+
+    bool sendControlChange (uint8_t control, uint8_t value, SimpleMIDI::Channel channel) {
+        if (((control | value) >> 7) != 0)
+            return false;
+
+        QueuedMessage m;
+        m.length = encodeControlChange (channel, control, value, m.bytes);
+        return push (m);
+    }
+
+    bool sendProgramChange (uint8_t program, SimpleMIDI::Channel channel) {
+        if ((program >> 7) != 0)
+            return false;
+
+        QueuedMessage m;
+        m.length = encodeProgramChange (channel, program, m.bytes);
+        return push (m);
+    }
+
+    bool sendPitchBend (int16_t pitch, SimpleMIDI::Channel channel) {
+        if ((pitch < -8192) || (pitch > 8191))
+            return false;
+
+        QueuedMessage m;
+        m.length = encodePitchBend (channel, pitch, m.bytes);
+        return push (m);
+    }
+
+    bool sendMIDIClockTick() {
+        QueuedMessage m;
+        m.bytes[0] = SimpleMIDI::ClockTickCmd;
+        m.length = 1;
+        return push (m);
+    }
+
+    /** Queues any complete message of up to 3 bytes */
+    bool sendRawMessage (const uint8_t *message, uint8_t length) {
+        if ((length == 0) || (length > 3))
+            return false;
+
+        QueuedMessage m;
+        memcpy (m.bytes, message, length);
+        m.length = length;
+        return push (m);
+    }
+
+    /** Returns the number of messages dropped so far because the ring was full */
+    uint32_t getNumDroppedMessages() {
+        return numMessagesDropped.load (std::memory_order_relaxed);
+    }
+
+private:
+
+    // 4 bytes, so that a cache line holds 16 messages
+    struct QueuedMessage {
+        uint8_t bytes[3];
+        uint8_t length;
+    };
+
+    static const uint32_t noteOffReserve = SIMPLE_MIDI_REALTIME_SEND_QUEUE_SIZE / 8;
+
+    SimpleMIDI &midiConnection;
+    SPSCQueue<QueuedMessage, SIMPLE_MIDI_REALTIME_SEND_QUEUE_SIZE> queue;
+    std::atomic<uint32_t> numMessagesDropped {0};
+    std::atomic<bool> ioThreadShouldExit {false};
+    const std::chrono::microseconds drainInterval;
+    const OverflowPolicy overflowPolicy;
+    std::thread ioThread;
+
+    bool push (const QueuedMessage &m) {
+        if ((overflowPolicy == KeepRoomForNoteOffs) && !isNoteOff (m) && (queue.size() >= queue.getCapacity() - noteOffReserve)) {
+            numMessagesDropped.fetch_add (1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (queue.push (m))
+            return true;
+
+        numMessagesDropped.fetch_add (1, std::memory_order_relaxed);
+        return false;
+    }
+
+    static bool isNoteOff (const QueuedMessage &m) {
+        const uint8_t command = m.bytes[0] >> 4;
+        return (command == SimpleMIDI::NoteOffCmd) || ((command == SimpleMIDI::NoteOnCmd) && (m.bytes[2] == 0));
+    }
+
+    void ioThreadWork() {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::Send);
+#ifdef SIMPLE_MIDI_TTY
+        prctl (PR_SET_TIMERSLACK, 1);
+#endif
+        QueuedMessage messages[64];
+
+        while (true) {
+            // read the exit flag first, so that everything pushed before the destructor was called is still sent
+            const bool shouldExit = ioThreadShouldExit;
+
+            size_t numMessages = queue.pop (messages, 64);
+            if (numMessages > 0) {
+                midiConnection.beginBatch();
+                do {
+                    for (size_t i = 0; i < numMessages; i++)
+                        midiConnection.sendRawMIDIBuffer (messages[i].bytes, messages[i].length);
+                    numMessages = queue.pop (messages, 64);
+                } while (numMessages > 0);
+                midiConnection.flush();
+            }
+
+            if (shouldExit)
+                return;
+
+            std::this_thread::sleep_for (drainInterval);
+        }
+    }
+};
+
+
+/**
+ * Paces all output of a connection to the speed of a serial MIDI link, so that realtime messages never wait behind
+ * a large SysEx. A 5-pin DIN link at 31250 baud only carries 3125 bytes per second, which is 320 us per byte, but
+ * the driver accepts any amount of data at once. Without pacing, a clock tick sent right after a 10 kB dump sits in
+ * the driver's buffer for more than three seconds.
+ *
+ * While the pacer is attached, everything sent through the connection is sorted into three lanes:
+ * - realtime bytes like clock ticks, which may be inserted anywhere in the stream, even between SysEx bytes
+ * - channel and system common messages
+ * - SysEx and other bulk data
+ * A pacer thread writes the lanes in this order of priority, byte by byte, at the wire rate. A token bucket allows
+ * at most maxBacklogBytes to be written ahead of the wire, so a realtime byte never waits for more than this many
+ * byte times. Once a message was started it is finished before the next one from a lower lane, as the MIDI standard
+ * doesn't allow anything but realtime bytes in the middle of a message.
+ *
+ * Sending through a connection with an attached pacer is thread safe and never blocks for the wire. Attaching the
+ * pacer disables thread safe sending of the connection, so don't attach it while other threads are sending.
+ * beginBatch() and flush() have no effect while it is attached. Other threads may keep sending while the pacer is
+ * destroyed, they wait until it has written everything it took.
+ */
+class MIDIWirePacer {
+
+public:
+
+    enum Lane : uint8_t {
+        RealtimeLane,
+        ChannelLane,
+        BulkLane,
+        NumLanes
+    };
+
+    /**
+     * @param midiConnectionToAttachTo  The connection to pace, it should be a serial connection
+     * @param baudRate                  The rate of the link, MIDI uses 31250 baud with 10 bits per byte
+     * @param maxBacklogBytes           Number of bytes that may be written ahead of the wire. 1 keeps the latency
+     *                                  of realtime bytes below one byte time, higher values tolerate more jitter
+     *                                  of the pacer thread's wake ups
+     */
+    MIDIWirePacer (SimpleMIDI &midiConnectionToAttachTo, uint32_t baudRate = 31250, uint16_t maxBacklogBytes = 1)
+      : midiConnection (midiConnectionToAttachTo),
+        nanosecondsPerByte (10000000000ULL / baudRate),
+        bucketDepth (maxBacklogBytes > 0 ? maxBacklogBytes : 1) {
+        // the pacer thread has to be the only one writing to the device
+        midiConnection.setThreadSafeSending (false);
+        midiConnection.flush();
+        lastRefill = MIDITimestamp::now();
+        tokens = bucketDepth * nanosecondsPerByte;
+        pacerThread = std::thread (&MIDIWirePacer::pacerThreadWork, this);
+        midiConnection.wirePacer.store (this);
+    }
+
+    /** Writes everything still waiting in the lanes at the wire rate before it returns */
+    ~MIDIWirePacer() {
+        // Senders that don't find the pacer anymore wait until the lanes are written. Once no sender is inside
+        // enqueue(), nothing can be added to the lanes anymore and the pacer thread drains them before it exits
+        midiConnection.wirePacerDetaching.store (true);
+        midiConnection.wirePacer.store (nullptr);
+        while (midiConnection.numSendersInWirePacer.load() != 0)
+            std::this_thread::yield();
+
+        {
+            std::lock_guard<std::mutex> lock (laneMutex);
+            pacerThreadShouldExit = true;
+        }
+        wakeUpPacer.notify_one();
+        pacerThread.join();
+        midiConnection.wirePacerDetaching.store (false);
+    }
+
+    /** Sorts the bytes into the lanes. Called by the connection for everything that is sent */
+    void enqueue (const uint8_t *bytes, int length) {
+        {
+            std::lock_guard<std::mutex> lock (laneMutex);
+            for (int i = 0; i < length; i++)
+                sortIntoLane (bytes[i]);
+        }
+        wakeUpPacer.notify_one();
+    }
+
+    /** Returns the number of bytes waiting in a lane */
+    size_t getNumBytesPending (Lane lane) {
+        std::lock_guard<std::mutex> lock (laneMutex);
+        return lanes[lane].size();
+    }
+
+    /** Returns the time it takes to transmit all bytes currently waiting in microseconds */
+    uint64_t getEstimatedDrainTime() {
+        std::lock_guard<std::mutex> lock (laneMutex);
+        return (lanes[RealtimeLane].size() + lanes[ChannelLane].size() + lanes[BulkLane].size()) * nanosecondsPerByte / 1000;
+    }
+
+private:
+
+    SimpleMIDI &midiConnection;
+    const uint64_t nanosecondsPerByte;
+    const uint16_t bucketDepth;
+
+    std::thread pacerThread;
+    std::mutex laneMutex;
+    std::condition_variable wakeUpPacer;
+    bool pacerThreadShouldExit = false;
+
+    std::deque<uint8_t> lanes[NumLanes];
+    bool enqueueingSysEx = false;
+
+    // Only used by the pacer thread. The tokens are counted in nanoseconds of wire time
+    uint64_t tokens;
+    uint64_t lastRefill;
+    Lane laneInProgress = NumLanes;
+    uint8_t numBytesLeftInMessage = 0;
+
+    void sortIntoLane (uint8_t byte) {
+        if (byte >= SimpleMIDI::ClockTickCmd) {
+            lanes[RealtimeLane].push_back (byte);
+            return;
+        }
+
+        if (enqueueingSysEx) {
+            if ((byte & 0b10000000) == 0) {
+                lanes[BulkLane].push_back (byte);
+                return;
+            }
+
+            // A SysEx ends with a SysEx end. Any other status byte ends it too, the bulk lane then gets the missing
+            // SysEx end so that the pacer knows the message is complete
+            lanes[BulkLane].push_back ((uint8_t)SimpleMIDI::SysExEnd);
+            enqueueingSysEx = false;
+            if (byte == (uint8_t)SimpleMIDI::SysExEnd)
+                return;
+        }
+
+        if (byte == (uint8_t)SimpleMIDI::SysExBegin) {
+            lanes[BulkLane].push_back (byte);
+            enqueueingSysEx = true;
+            return;
+        }
+
+        lanes[ChannelLane].push_back (byte);
+    }
+
+    static uint8_t messageLength (uint8_t status) {
+        // a data byte at the front of the lane is the rest of a message sent in several pieces
+        return ((status & 0b10000000) == 0) ? 1 : encodedLength (status);
+    }
+
+    // Picks the next byte to write. Must be called with the lane mutex held, returns false if there is none
+    bool nextByte (uint8_t &byte) {
+        if (!lanes[RealtimeLane].empty()) {
+            byte = lanes[RealtimeLane].front();
+            lanes[RealtimeLane].pop_front();
+            return true;
+        }
+
+        if (laneInProgress == NumLanes) {
+            // start the next message, channel messages first
+            if (!lanes[ChannelLane].empty()) {
+                laneInProgress = ChannelLane;
+                numBytesLeftInMessage = messageLength (lanes[ChannelLane].front());
+            }
+            else if (!lanes[BulkLane].empty()) {
+                laneInProgress = BulkLane;
+            }
+            else {
+                return false;
+            }
+        }
+
+        std::deque<uint8_t> &lane = lanes[laneInProgress];
+        if (lane.empty())
+            return false;
+
+        byte = lane.front();
+        lane.pop_front();
+
+        if (laneInProgress == ChannelLane) {
+            // some data bytes might not have arrived yet if a message was sent in several pieces
+            if (--numBytesLeftInMessage == 0)
+                laneInProgress = NumLanes;
+        }
+        else if (byte == (uint8_t)SimpleMIDI::SysExEnd) {
+            laneInProgress = NumLanes;
+        }
+        return true;
+    }
+
+    void refillTokens() {
+        const uint64_t now = MIDITimestamp::now();
+        tokens += now - lastRefill;
+        lastRefill = now;
+        if (tokens > bucketDepth * nanosecondsPerByte)
+            tokens = bucketDepth * nanosecondsPerByte;
+    }
+
+    void pacerThreadWork() {
+        MIDIThreadConfiguration::applyToCurrentThread (MIDIThreadConfiguration::Timing);
+#ifdef SIMPLE_MIDI_TTY
+        // The default timer slack of 50 us would be a sixth of a byte time
+        prctl (PR_SET_TIMERSLACK, 1);
+#endif
+        uint8_t bytesToWrite[64];
+        std::unique_lock<std::mutex> lock (laneMutex);
+
+        while (true) {
+            refillTokens();
+
+            int numBytes = 0;
+            while ((tokens >= nanosecondsPerByte) && (numBytes < 64) && nextByte (bytesToWrite[numBytes])) {
+                tokens -= nanosecondsPerByte;
+                numBytes++;
+            }
+
+            if (numBytes > 0) {
+                lock.unlock();
+                midiConnection.writeThroughSendPipeline (bytesToWrite, numBytes);
+                lock.lock();
+                continue;
+            }
+
+            const bool nothingPending = lanes[RealtimeLane].empty() && lanes[ChannelLane].empty() && lanes[BulkLane].empty();
+            if (nothingPending) {
+                if (pacerThreadShouldExit)
+                    return;
+                wakeUpPacer.wait (lock);
+            }
+            else if (tokens < nanosecondsPerByte) {
+                // sleep until the wire has room for the next byte
+                wakeUpPacer.wait_for (lock, std::chrono::nanoseconds (nanosecondsPerByte - tokens));
+            }
+            else {
+                // only a part of a message arrived yet, wait for the rest
+                wakeUpPacer.wait (lock);
+            }
+        }
+    }
+};
+
+/** Returns false if no pacer is attached and the bytes have to be sent another way */
+inline bool SimpleMIDI::sendThroughWirePacer (const uint8_t *bytesToSend, int length) {
+    if (wirePacer.load (std::memory_order_acquire) != nullptr) {
+        // Counted before the pacer is loaded again, so the destructor either waits for this sender or the sender
+        // doesn't find the pacer anymore
+        numSendersInWirePacer.fetch_add (1);
+        MIDIWirePacer *pacer = wirePacer.load();
+        if (pacer != nullptr)
+            pacer->enqueue (bytesToSend, length);
+        numSendersInWirePacer.fetch_sub (1);
+
+        if (pacer != nullptr)
+            return true;
+    }
+
+    while (wirePacerDetaching.load (std::memory_order_acquire))
+        std::this_thread::yield();
+    return false;
+}
+
+
+#endif
+
+
+
+#ifdef SIMPLE_MIDI_TTY
+#include "ArchitectureSpecific/Linux/TTYMIDIWrapperImpl.h"
+
+#elif defined SIMPLE_MIDI_MAC
+#import "ArchitectureSpecific/MacOSX/CoreMIDIWrapperImpl.h"
+
+#elif defined SIMPLE_MIDI_WINDOWS
+// todo: Implement Windows specific MIDI Class
+#error "Currently no Windows specific implementation of SimpleMIDI"
+
+#elif defined SIMPLE_MIDI_ARDUINO
+#include "ArchitectureSpecific/Arduino/ArduinoSerialMIDIWrapperImpl.h"
+
+#else
+#error "Unknown Plattfom for SimpleMIDI"
+
+#endif
+
+#ifdef SIMPLE_MIDI_MULTITHREADED
+#include "ArchitectureSpecific/Virtual/VirtualMIDIPort.h"
 #endif
 
 #endif /* simpleMIDI_h */